@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include <sys/eventfd.h>
+
+#include "checkpoint.hpp"
+#include "config.hpp"
+#include "database.hpp"
+#include "history.hpp"
+#include "journal.hpp"
+#include "log.h"
+#include "nameTable.hpp"
+#include "snapshot.hpp"
+#include "state.hpp"
+#include "timebase.hpp"
+#include "util.hpp"
+
+/// Protects checkpointRequested and checkpointStopping
+std::mutex checkpointMutex;
+
+/// Wakes the checkpoint thread up when a checkpoint is requested or when it has to stop
+std::condition_variable checkpointWake;
+
+/// Whether a checkpoint was requested before the end of the period
+bool checkpointRequested = false;
+
+/// Whether the checkpoint thread has to stop
+bool checkpointStopping = false;
+
+/// Whether a checkpoint is being written, and how many were attempted, protected by checkpointMutex too
+bool checkpointRunning = false;
+uint64_t checkpointCount = 0;
+
+/// Whether the last checkpoint attempted was written, and the time since boot of its snapshot, in clock ticks
+bool checkpointWritten = false;
+int64_t checkpointTime = 0;
+
+/// Header of the segment of the current boot, only used by the checkpoint thread as the history below
+SegmentHeader segment{};
+
+/// Buckets of the current boot
+HistoryBuckets history;
+
+/// Uptimes projected when the history was last updated, by name ID
+std::vector<int64_t> historyUptimes;
+
+/// Whether the history of a previous run was reopened without knowing what of the running processes it holds
+bool baselinePending = false;
+
+/// Whether the buffers were restored from a previous run, which told the history what it holds with resumeHistory
+bool historyResumed = false;
+
+/// Day the segments of the previous boots were last compacted, in days since the epoch
+int64_t compactionDay = -1;
+
+
+/**
+ * Start the history of the current boot, from its segment if a previous run of the daemon wrote one
+ *
+ * Unless the buffers of that run were restored, what its history holds of the running processes is only known
+ * from the first snapshot
+ */
+void openHistory () {
+    std::string id = bootId();
+    strncpy(segment.bootId, id.c_str(), sizeof(segment.bootId) - 1);
+    segment.bootTime = std::llround(bootEpoch());
+    segment.endTime = segment.bootTime;
+    segment.hourlySince = segment.bootTime / DAY_BUCKET * DAY_BUCKET;
+
+    Segment previous;
+    if (!id.empty() && previous.open(segmentPath(id).c_str())) {
+        previous.buckets(history);
+        segment.endTime = previous.info().endTime;
+        segment.hourlySince = previous.info().hourlySince;
+        baselinePending = !historyResumed;
+    }
+}
+
+/**
+ * What the history of a previous run holds of the processes of a snapshot
+ *
+ * The processes running since before the end of the segment were counted by that run up to then
+ *
+ * @param snapshot : the first snapshot of this run
+ *
+ * @return the uptimes up to the end of the segment of the processes that started before it, by name ID
+ */
+std::vector<int64_t> historyBaseline (const TrackingSnapshot& snapshot) {
+    int64_t endTime = toTicks(segment.endTime - bootEpoch());
+    TrackingSnapshot before{0, endTime, ProcessTable(), {}, snapshot.parallelTracking};
+    const ProcessTable& processBuffer = snapshot.processBuffer;
+    for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+        if (processBuffer.states[slot] == ProcessTable::LIVE && processBuffer.startTimes[slot] < endTime)
+            before.processBuffer.insert(processBuffer.pids[slot], processBuffer.nameIds[slot], processBuffer.startTimes[slot]);
+    }
+    return projectUptimes(before, endTime);
+}
+
+/**
+ * Add an uptime to the buckets of a time range
+ *
+ * The uptime is shared between the hours of the range in proportion to how much of the range each one covers
+ *
+ * @param name : the name the uptime belongs to
+ * @param uptime : the uptime, in clock ticks
+ * @param from : start of the range, in seconds since the epoch
+ * @param to : end of the range, in seconds since the epoch
+ */
+void spreadUptime (const std::string& name, int64_t uptime, double from, double to) {
+    int64_t left = uptime;
+    int64_t hour = (int64_t) std::floor(from / HOUR_BUCKET) * HOUR_BUCKET;
+    while (left != 0) {
+        int64_t part = left;
+        if (hour + HOUR_BUCKET < to)
+            part = (int64_t) (uptime * ((hour + HOUR_BUCKET - std::max(from, (double) hour)) / (to - from)));
+        history[{HOUR_BUCKET, hour}][name] += part;
+        history[{DAY_BUCKET, hour / DAY_BUCKET * DAY_BUCKET}][name] += part;
+        left -= part;
+        hour += HOUR_BUCKET;
+    }
+}
+
+/**
+ * Compact the segments of the boots over for cold_segment_age days
+ *
+ * The segment of the current boot is never compacted, it is still written
+ */
+void compactHistory () {
+    std::vector<HistoryIndexEntry> boots;
+    if (!readHistoryIndex(boots))
+        return;
+    int64_t before = time(nullptr) - (int64_t) (config::cold_segment_age * DAY_BUCKET);
+    for (auto& boot : boots) {
+        if (boot.endTime >= before || strncmp(boot.bootId, segment.bootId, sizeof(boot.bootId)) == 0 ||
+            !std::filesystem::exists(segmentPath(boot.bootId)))
+            continue;
+        if (!compactSegment(boot.bootId)) {
+            std::string errmsg = "Compacting the history : " + segmentPath(boot.bootId);
+            error(errmsg.c_str(), ERROR);
+        }
+    }
+}
+
+/**
+ * Add to the history what ran since its last update and write the segment of the current boot
+ *
+ * The uptimes gained by each name since the last update are spread over the time in between
+ * The hours older than HOURLY_RETENTION are dropped, their days keep them
+ * Once a day, the segments of the previous boots that got old are compacted
+ * Nothing is done until the tracking thread published its first snapshot
+ *
+ * @param snapshot : the snapshot, its uptimes are projected to its time
+ */
+void updateHistory (const TrackingSnapshot& snapshot) {
+    if (segment.bootId[0] == '\0' || snapshot.generation == 0)
+        return;
+    if (baselinePending) {
+        historyUptimes = historyBaseline(snapshot);
+        baselinePending = false;
+    }
+    int64_t time = snapshot.time;
+    std::vector<int64_t> uptimes = projectUptimes(snapshot, time);
+    double from = segment.endTime;
+    double to = std::max(bootEpoch() + toSeconds(time), from);
+    for (uint32_t id = 0; id < uptimes.size(); ++id) {
+        int64_t gained = uptimes[id] - nameEntry(historyUptimes, id);
+        if (gained != 0)
+            spreadUptime(std::string(nameOf(id)), gained, from, to);
+    }
+    historyUptimes = uptimes;
+    segment.endTime = std::llround(to);
+
+    int64_t hourlySince = (segment.endTime - HOURLY_RETENTION) / DAY_BUCKET * DAY_BUCKET;
+    if (hourlySince > segment.hourlySince) {
+        history.erase(history.begin(), history.lower_bound({HOUR_BUCKET, hourlySince}));
+        segment.hourlySince = hourlySince;
+    }
+
+    if (!writeSegment(segment, history) || !indexSegment(segment)) {
+        std::string errmsg = "Writing the history : " + std::string(HISTORY_DIR);
+        error(errmsg.c_str(), ERROR);
+    }
+
+    if (segment.endTime / DAY_BUCKET != compactionDay) {
+        compactionDay = segment.endTime / DAY_BUCKET;
+        compactHistory();
+    }
+}
+
+/**
+ * Write the uptimes of the current boot in the checkpoint file
+ *
+ * The journal is rotated where the last snapshot is, then the uptimes of its finished processes are written in the
+ * checkpoint file, and its running processes in the state of the checkpoint
+ * A replay folds the finished processes only, a daemon restarted in the same boot goes on counting the running ones
+ * from the state, after another boot they are counted until the checkpoint
+ * Both store the sequence number of the journal closed, the next journal holds the time of the snapshot, so that a
+ * replay tells the processes that were running at the checkpoint from those started after it
+ * The history of the current boot is updated from the snapshot too
+ * The tracking thread is never waited for, nor is the buffer it writes to touched
+ *
+ * @return true  : if the checkpoint was written
+ *         false : otherwise, the journal goes on as if there had been no checkpoint
+ */
+bool writeCheckpoint () {
+    std::shared_ptr<const TrackingSnapshot> snapshot;
+    uint64_t sequence = rotateJournal([&] {
+        snapshot = currentSnapshot();
+        return snapshot->journalMark;
+    });
+    if (snapshot->generation == 0) { // nothing was tracked yet
+        cancelRotation();
+        return false;
+    }
+
+    updateHistory(*snapshot);
+    // written first, a state left by a checkpoint that failed after it holds another sequence number
+    // the uptimes go to the checkpoint itself
+    if (!writeState(CHECKPOINT_STATE_FILE, snapshot->processBuffer, {}, snapshot->parallelTracking, snapshot->time,
+                    sequence)) {
+        std::string errmsg = "Writing the state of the checkpoint : " + std::string(CHECKPOINT_STATE_FILE);
+        error(errmsg.c_str(), ERROR);
+    }
+    std::vector<std::pair<std::string, int64_t>> entries;
+    for (uint32_t id = 0; id < snapshot->uptimeBuffer.size(); ++id) {
+        if (snapshot->uptimeBuffer[id] != 0)
+            entries.emplace_back(nameOf(id), snapshot->uptimeBuffer[id]);
+    }
+    if (!writeDatabase(CHECKPOINT_FILE, std::move(entries), sequence)) {
+        std::string errmsg = "Writing the checkpoint : " + std::string(CHECKPOINT_FILE);
+        error(errmsg.c_str(), ERROR);
+        cancelRotation();
+        return false;
+    }
+    startJournal(snapshot->time);
+    std::lock_guard<std::mutex> lock(checkpointMutex);
+    checkpointTime = snapshot->time;
+    return true;
+}
+
+/**
+ * Make the checkpoint thread write a checkpoint now
+ */
+void requestCheckpoint () {
+    std::lock_guard<std::mutex> lock(checkpointMutex);
+    checkpointRequested = true;
+    checkpointWake.notify_one();
+}
+
+/**
+ * Make the checkpoint thread write a checkpoint now, whose outcome is told by checkpointSaved
+ *
+ * A checkpoint already being written may miss what happened since, the next one is awaited then
+ *
+ * @return the checkpoint awaited
+ */
+uint64_t requestSave () {
+    std::lock_guard<std::mutex> lock(checkpointMutex);
+    checkpointRequested = true;
+    checkpointWake.notify_one();
+    return checkpointCount + (checkpointRunning ? 2 : 1);
+}
+
+/**
+ * Whether the checkpoint awaited after requestSave was attempted, without waiting for it
+ *
+ * @param awaited : the checkpoint returned by requestSave
+ * @param written : set to whether it was written, once it was attempted
+ *
+ * @return true  : if it was attempted, or will never be as the thread stopped
+ *         false : if it is still awaited, checkpointFd becomes readable after each attempt
+ */
+bool checkpointSaved (uint64_t awaited, bool& written) {
+    std::lock_guard<std::mutex> lock(checkpointMutex);
+    if (checkpointCount < awaited && !checkpointStopping)
+        return false;
+    written = checkpointCount >= awaited && checkpointWritten;
+    return true;
+}
+
+/**
+ * Event file that becomes readable after each checkpoint attempted, and when the checkpoint thread stops
+ *
+ * @return the event file
+ */
+int checkpointFd () {
+    static const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return fd;
+}
+
+/**
+ * Time of the last checkpoint written
+ *
+ * @return the time since boot of its snapshot, in clock ticks, 0 if none was written
+ */
+int64_t lastCheckpoint () {
+    std::lock_guard<std::mutex> lock(checkpointMutex);
+    return checkpointTime;
+}
+
+/**
+ * Tell those waiting on checkpointFd that a checkpoint was attempted
+ */
+void notifyCheckpoint () {
+    uint64_t one = 1;
+    write(checkpointFd(), &one, sizeof(one));
+}
+
+/**
+ * Main of the checkpoint thread
+ *
+ * Write a checkpoint every checkpoint_period seconds, and when one is requested
+ * A crash loses at most the uptimes of one period: the processes that ran since the last checkpoint without finishing
+ * With a period of 0, checkpoints are only written when requested
+ * A checkpoint is also written at each hour, the history then puts the uptimes of each hour in its own bucket
+ * Those waiting for a checkpoint are told through checkpointFd once it is attempted
+ * The history gets a last update when the thread is stopped
+ */
+void checkpointThread () {
+    mask_sig();
+    openHistory();
+    std::unique_lock<std::mutex> lock(checkpointMutex);
+    while (!checkpointStopping) {
+        auto woken = [] { return checkpointStopping || checkpointRequested; };
+        time_t now = time(nullptr);
+        double wait = (double) (now / HOUR_BUCKET + 1) * HOUR_BUCKET - now;
+        if (config::checkpoint_period > 0)
+            wait = std::min(wait, (double) config::checkpoint_period);
+        checkpointWake.wait_for(lock, std::chrono::milliseconds((long) (wait * 1000)), woken);
+        if (checkpointStopping)
+            break;
+        checkpointRequested = false;
+        checkpointRunning = true;
+        lock.unlock();
+        bool written = writeCheckpoint();
+        lock.lock();
+        checkpointRunning = false;
+        ++checkpointCount;
+        checkpointWritten = written;
+        notifyCheckpoint();
+    }
+    notifyCheckpoint();
+    lock.unlock();
+
+    updateHistory(*currentSnapshot());
+}
+
+/**
+ * Make the checkpoint thread return, the final save is left to the caller
+ */
+void stopCheckpoints () {
+    std::lock_guard<std::mutex> lock(checkpointMutex);
+    checkpointStopping = true;
+    checkpointWake.notify_one();
+}
+
+/**
+ * Tell the history what the previous daemon already put in it, before the checkpoint thread starts
+ *
+ * The processes restored from its state ran before it stopped, only what they run from now on is new to the history
+ *
+ * @param uptimes : uptimes of the restored buffers by name ID, projected to the time the previous daemon stopped
+ */
+void resumeHistory (const std::vector<int64_t>& uptimes) {
+    historyUptimes = uptimes;
+    historyResumed = true;
+}
+
+/**
+ * Restore the processes that were running at the checkpoint folded by the replay of the journal
+ *
+ * The state of the checkpoint is only restored if it was written with it, the processes the journal after it saw
+ * finish are left out, the replay counted them
+ *
+ * @param journalSequence : sequence number of the checkpoint folded, returned by replayJournal
+ * @param ended : records of the processes that finished after it, filled by replayJournal
+ * @param processBuffer : filled with the processes still running
+ * @param parallelTracking : filled with the intervals of the parallel tracking
+ * @param checkpointTime : filled with the time since boot of the checkpoint, in clock ticks
+ * @param sameBoot : whether the checkpoint was written during the current boot, the times are only valid then
+ *
+ * @return true  : if the processes were restored
+ *         false : if there is no state of that checkpoint
+ */
+bool recoverCheckpoint (uint64_t journalSequence, const std::vector<EarlierRecord>& ended, ProcessTable& processBuffer,
+                        std::vector<IntervalUnion>& parallelTracking, int64_t& checkpointTime, bool& sameBoot) {
+    uint64_t stateSequence = 0;
+    std::vector<int64_t> uptimes;
+    if (!loadState(CHECKPOINT_STATE_FILE, processBuffer, uptimes, parallelTracking, checkpointTime, sameBoot,
+                   stateSequence))
+        return false;
+    if (stateSequence != journalSequence) {
+        processBuffer.clear();
+        parallelTracking.clear();
+        return false;
+    }
+
+    // a single pass over the table, erasing moves the slots so the PIDs are collected first
+    std::map<std::pair<int64_t, std::string_view>, size_t> endedCount;
+    for (auto& record : ended)
+        ++endedCount[{record.startTime, record.name}];
+    std::vector<int> endedPids;
+    for (size_t slot = 0; slot < processBuffer.capacity() && endedPids.size() < ended.size(); ++slot) {
+        if (processBuffer.states[slot] != ProcessTable::LIVE)
+            continue;
+        auto count = endedCount.find({processBuffer.startTimes[slot], nameOf(processBuffer.nameIds[slot])});
+        if (count != endedCount.end() && count->second > 0) {
+            --count->second;
+            endedPids.push_back(processBuffer.pids[slot]);
+        }
+    }
+    for (int pid : endedPids)
+        processBuffer.erase(processBuffer.find(pid));
+    return true;
+}
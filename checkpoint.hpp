@@ -0,0 +1,29 @@
+#ifndef YOTTA_CHECKPOINT_HPP
+#define YOTTA_CHECKPOINT_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "intervalUnion.hpp"
+#include "journal.hpp"
+#include "processTable.hpp"
+
+/// Uptimes of the finished processes of the current boot at the last checkpoint, in the database format
+const char* const CHECKPOINT_FILE = "/var/lib/yotta/uptime.checkpoint";
+
+/// Processes running at the last checkpoint, in the state format
+const char* const CHECKPOINT_STATE_FILE = "/var/lib/yotta/uptime.checkpoint.state";
+
+bool writeCheckpoint();
+void requestCheckpoint();
+uint64_t requestSave();
+bool checkpointSaved(uint64_t awaited, bool& written);
+int checkpointFd();
+int64_t lastCheckpoint();
+void checkpointThread();
+void stopCheckpoints();
+void resumeHistory(const std::vector<int64_t>& uptimes);
+bool recoverCheckpoint(uint64_t journalSequence, const std::vector<EarlierRecord>& ended, ProcessTable& processBuffer,
+                       std::vector<IntervalUnion>& parallelTracking, int64_t& checkpointTime, bool& sameBoot);
+
+#endif //YOTTA_CHECKPOINT_HPP
@@ -1,4 +1,14 @@
 namespace config {
     int precision = 2;
+    float min_precision = 0.5;
+    float max_precision = 10;
+    int scan_threads = 1;
     bool track_parallel_processes = true;
+    bool proc_connector = true;
+    bool io_uring = true;
+    int pidfd_budget = 4096;
+    int listen_backlog = 64;
+    float client_timeout = 5;
+    float checkpoint_period = 60;
+    float cold_segment_age = 30;
 }
\ No newline at end of file
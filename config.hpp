@@ -3,7 +3,17 @@
 
 namespace config {
     extern int precision;
+    extern float min_precision;
+    extern float max_precision;
+    extern int scan_threads;
     extern bool track_parallel_processes;
+    extern bool proc_connector;
+    extern bool io_uring;
+    extern int pidfd_budget;
+    extern int listen_backlog;
+    extern float client_timeout;
+    extern float checkpoint_period;
+    extern float cold_segment_age;
 }
 
 #endif //YOTTA_CONFIG_HPP
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "database.hpp"
+#include "log.h"
+#include "timebase.hpp"
+#include "util.hpp"
+
+
+Database::~Database() {
+    if (data)
+        munmap((void*) data, length);
+}
+
+/**
+ * Map the database in memory
+ *
+ * Only the header is checked, the index and the names are read when they are looked up
+ *
+ * @param path : path of the database
+ *
+ * @return true  : if the database is mapped
+ *         false : if it does not exist or is not a database of this version
+ */
+bool Database::open(const char* path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(DatabaseHeader)) {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    data = (const char*) mapping;
+    length = st.st_size;
+    header = (const DatabaseHeader*) data;
+    if (memcmp(header->magic, DATABASE_MAGIC, sizeof(DATABASE_MAGIC)) != 0 || header->version != DATABASE_VERSION ||
+        header->ticksPerSecond == 0 ||
+        sizeof(DatabaseHeader) + header->count * sizeof(DatabaseEntry) + header->namesSize != length) {
+        munmap(mapping, length);
+        data = nullptr;
+        return false;
+    }
+    entries = (const DatabaseEntry*) (data + sizeof(DatabaseHeader));
+    names = (const char*) (entries + header->count);
+    return true;
+}
+
+/**
+ * Number of names in the database
+ *
+ * @return the number of entries of the index
+ */
+size_t Database::size() const {
+    return data ? header->count : 0;
+}
+
+/**
+ * Name of an entry
+ *
+ * @param entry : index of the entry
+ *
+ * @return the name, which points into the mapping, empty if it does not fit in the names
+ */
+std::string_view Database::name(size_t entry) const {
+    const DatabaseEntry& e = entries[entry];
+    if ((uint64_t) e.nameOffset + e.nameLength > header->namesSize)
+        return std::string_view();
+    return std::string_view(names + e.nameOffset, e.nameLength);
+}
+
+/**
+ * Total of an entry
+ *
+ * @param entry : index of the entry
+ *
+ * @return the uptime over the previous boots, in clock ticks of this host
+ */
+int64_t Database::total(size_t entry) const {
+    int64_t total = entries[entry].total;
+    if (header->ticksPerSecond != (uint64_t) ticksPerSecond())
+        total = total * ticksPerSecond() / header->ticksPerSecond;
+    return total;
+}
+
+/**
+ * Look a name up in the index
+ *
+ * @param name : the name
+ * @param total : filled with its uptime over the previous boots, in clock ticks
+ *
+ * @return true  : if the name is in the database
+ *         false : otherwise
+ */
+bool Database::find(std::string_view name, int64_t& total) const {
+    size_t low = 0, high = size();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        int order = this->name(middle).compare(name);
+        if (order == 0) {
+            total = this->total(middle);
+            return true;
+        }
+        if (order < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return false;
+}
+
+/**
+ * Last journal folded into the database
+ *
+ * @return the sequence number of the journal, 0 if there is no database
+ */
+uint64_t Database::journalSequence() const {
+    return data ? header->journalSequence : 0;
+}
+
+/**
+ * Write a database
+ *
+ * It is written next to the path then renamed, a reader sees either the previous database or the new one
+ *
+ * @param path : path of the database
+ * @param totals : name and uptime over the previous boots of each entry, in clock ticks
+ * @param journalSequence : last journal whose records are in the totals
+ *
+ * @return true  : if the database was written
+ *         false : otherwise
+ */
+bool writeDatabase(const char* path, std::vector<std::pair<std::string, int64_t>> totals, uint64_t journalSequence) {
+    std::sort(totals.begin(), totals.end());
+
+    DatabaseHeader header{};
+    memcpy(header.magic, DATABASE_MAGIC, sizeof(DATABASE_MAGIC));
+    header.version = DATABASE_VERSION;
+    header.count = totals.size();
+    header.ticksPerSecond = ticksPerSecond();
+    header.journalSequence = journalSequence;
+
+    std::vector<DatabaseEntry> entries;
+    entries.reserve(totals.size());
+    std::string names;
+    for (auto& total : totals) {
+        entries.push_back({total.second, (uint32_t) names.size(), (uint32_t) total.first.size()});
+        names += total.first;
+    }
+    header.namesSize = names.size();
+
+    std::string temporary = std::string(path) + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = write(fd, &header, sizeof(header)) == sizeof(header) &&
+                   write(fd, entries.data(), entries.size() * sizeof(DatabaseEntry)) == (ssize_t) (entries.size() * sizeof(DatabaseEntry)) &&
+                   write(fd, names.data(), names.size()) == (ssize_t) names.size() &&
+                   fsync(fd) == 0;
+    close(fd);
+    if (!written || rename(temporary.c_str(), path) < 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Convert the text database of the previous versions to the binary format
+ *
+ * Only done once: the binary database is written and the text file is kept as TEXT_DATABASE_FILE.old
+ * Lines are 'process name: uptime', the uptime in seconds
+ *
+ * @return true  : if there was nothing to convert or the conversion succeeded
+ *         false : if the binary database could not be written, the text file is left as it is
+ */
+bool convertTextDatabase() {
+    if (std::filesystem::exists(DATABASE_FILE) || !std::filesystem::exists(TEXT_DATABASE_FILE))
+        return true;
+
+    std::ifstream textDatabase (TEXT_DATABASE_FILE);
+    std::vector<std::pair<std::string, int64_t>> totals;
+    std::string line;
+    while (getline(textDatabase, line)) {
+        size_t colon = line.find_last_of(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string uptime = line.substr(colon + 1);
+        trim(uptime);
+        if (!isFloat(uptime))
+            continue;
+        totals.emplace_back(line.substr(0, colon), toTicks(std::stod(uptime)));
+    }
+    textDatabase.close();
+
+    // a name may appear several times in a file edited by hand
+    std::sort(totals.begin(), totals.end());
+    std::vector<std::pair<std::string, int64_t>> merged;
+    for (auto& total : totals) {
+        if (!merged.empty() && merged.back().first == total.first)
+            merged.back().second += total.second;
+        else
+            merged.push_back(std::move(total));
+    }
+
+    if (!writeDatabase(DATABASE_FILE, std::move(merged), 0)) {
+        error("Converting the text database", ERROR);
+        return false;
+    }
+    std::filesystem::rename(TEXT_DATABASE_FILE, std::string(TEXT_DATABASE_FILE) + ".old");
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef YOTTA_DATABASE_HPP
+#define YOTTA_DATABASE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// Uptimes of the previous boots, in the binary format
+const char* const DATABASE_FILE = "/var/lib/yotta/uptime.db";
+
+/// Uptimes of the previous boots, in the text format of the versions before the binary one
+const char* const TEXT_DATABASE_FILE = "/var/lib/yotta/uptime";
+
+/// Identifies the database file
+const char DATABASE_MAGIC[4] = {'Y', 'T', 'D', 'B'};
+
+/// Version of the database format, a database of another version is not read
+const uint16_t DATABASE_VERSION = 2;
+
+/**
+ * Start of the database file
+ *
+ * It is followed by the index, then by the names the index points into
+ * The file is written and read on the same host, numbers are in its byte order
+ */
+struct DatabaseHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t padding;
+    uint32_t count;           ///< number of entries in the index
+    uint32_t ticksPerSecond;  ///< clock ticks per second of the host that wrote the totals
+    uint64_t namesSize;       ///< size of the names, in bytes
+    uint64_t journalSequence; ///< last journal whose records are in the totals
+};
+
+/// Entry of the index, the index is sorted by name
+struct DatabaseEntry {
+    int64_t total;        ///< uptime of the name over the previous boots, in clock ticks
+    uint32_t nameOffset;  ///< where the name starts, from the start of the names
+    uint32_t nameLength;
+};
+
+/// Database mapped read-only in memory
+struct Database {
+    Database() = default;
+    ~Database();
+    Database(const Database&) = delete;
+    Database& operator= (const Database&) = delete;
+
+    bool open(const char* path);
+    size_t size() const;
+    std::string_view name(size_t entry) const;
+    int64_t total(size_t entry) const;
+    bool find(std::string_view name, int64_t& total) const;
+    uint64_t journalSequence() const;
+
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+    const DatabaseHeader* header = nullptr;
+    const DatabaseEntry* entries = nullptr;
+    const char* names = nullptr;
+};
+
+bool writeDatabase(const char* path, std::vector<std::pair<std::string, int64_t>> totals, uint64_t journalSequence);
+bool convertTextDatabase();
+
+#endif //YOTTA_DATABASE_HPP
@@ -0,0 +1,160 @@
+#include <chrono>
+#include <csignal>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "config.hpp"
+#include "exitWatcher.hpp"
+#include "log.h"
+#include "snapshot.hpp"
+#include "timeTracking.hpp"
+#include "timebase.hpp"
+#include "util.hpp"
+
+/// File descriptors kept for everything else than pidfds
+const size_t RESERVED_FDS = 64;
+
+/// Most exits handled by one epoll_wait
+const int MAX_EVENTS = 64;
+
+
+/**
+ * Prepare the exit notifications
+ *
+ * Raise the limit of open files as much as allowed, the budget of pidfds is bounded by it and by pidfd_budget
+ *
+ * @param watcher : the watcher to open
+ *
+ * @return true  : if pidfds can be used
+ *         false : otherwise, exits are only found by polling
+ */
+bool openExitWatcher(ExitWatcher& watcher) {
+    struct rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    watcher.budget = config::pidfd_budget;
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < watcher.budget + RESERVED_FDS)
+        watcher.budget = limit.rlim_cur > RESERVED_FDS ? limit.rlim_cur - RESERVED_FDS : 0;
+    if (watcher.budget == 0)
+        return false;
+
+    // check that the kernel has pidfds (5.3)
+    int self = syscall(SYS_pidfd_open, getpid(), 0);
+    if (self < 0) {
+        error("pidfd_open is not available, falling back to polling for exits", WARN);
+        return false;
+    }
+    close(self);
+
+    watcher.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (watcher.epollFd < 0) {
+        error("Creating the epoll instance of the exit watcher", WARN);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Close all the pidfds and the epoll instance
+ *
+ * @param watcher : the watcher to close
+ */
+void closeExitWatcher(ExitWatcher& watcher) {
+    for (auto& s : watcher.pidfds)
+        close(s.second);
+    watcher.pidfds.clear();
+    if (watcher.epollFd >= 0)
+        close(watcher.epollFd);
+    watcher.epollFd = -1;
+}
+
+/**
+ * Be notified when a process exits
+ *
+ * Once the budget is used, processes are left to the polling until pidfds are freed
+ *
+ * @param watcher : the watcher
+ * @param pid : PID of the process
+ *
+ * @return true  : if the process is watched
+ *         false : if its exit will only be found by polling
+ */
+bool watchProcess(ExitWatcher& watcher, int pid) {
+    if (watcher.pidfds.size() >= watcher.budget || watcher.pidfds.contains(pid))
+        return watcher.pidfds.contains(pid);
+
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd < 0) // the process already ended
+        return false;
+
+    struct epoll_event event{};
+    event.events = EPOLLIN; // a pidfd is readable once the process has exited
+    event.data.u64 = pid;
+    if (epoll_ctl(watcher.epollFd, EPOLL_CTL_ADD, pidfd, &event) < 0) {
+        close(pidfd);
+        return false;
+    }
+    watcher.pidfds.insert({pid, pidfd});
+    return true;
+}
+
+/**
+ * Stop being notified of the exit of a process
+ *
+ * @param watcher : the watcher
+ * @param pid : PID of the process
+ */
+void unwatchProcess(ExitWatcher& watcher, int pid) {
+    auto pidfd = watcher.pidfds.find(pid);
+    if (pidfd == watcher.pidfds.end())
+        return;
+    close(pidfd->second); // also removes it from the epoll instance
+    watcher.pidfds.erase(pidfd);
+}
+
+/**
+ * Wait for an interval and count the uptime of the watched processes as soon as they exit
+ *
+ * A snapshot is published after each batch of exits
+ * Return early if SIGTERM is received
+ *
+ * @param watcher : the watcher
+ * @param interval : time to wait, in seconds
+ * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
+ * @param processBuffer : buffer of still active processes
+ * @param gSignalStatus : signal received by the program
+ * @param parallelTracking : buffer of start/end time of each processes
+ */
+void waitExits(ExitWatcher& watcher, float interval, std::vector<int64_t>& uptimeBuffer,
+               ProcessTable& processBuffer, volatile sig_atomic_t& gSignalStatus,
+               std::vector<IntervalUnion>& parallelTracking) {
+    struct epoll_event events[MAX_EVENTS];
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds((long) (interval * 1000));
+
+    while (gSignalStatus != SIGTERM) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(end - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0)
+            return;
+        // wake up at least every second to check the signals
+        int ready = epoll_wait(watcher.epollFd, events, MAX_EVENTS, std::min<long>(remaining.count(), 1000));
+        if (ready <= 0)
+            continue;
+
+        int64_t now = bootTicks();
+        for (int i = 0; i < ready; ++i) {
+            int pid = (int) events[i].data.u64;
+            endProcess(processBuffer, uptimeBuffer, parallelTracking, pid, now);
+            unwatchProcess(watcher, pid);
+        }
+        publishSnapshot(processBuffer, uptimeBuffer, parallelTracking);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef YOTTA_EXITWATCHER_HPP
+#define YOTTA_EXITWATCHER_HPP
+
+#include <csignal>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "intervalUnion.hpp"
+#include "processTable.hpp"
+
+/// Exit notifications of the tracked processes, through one pidfd per process
+struct ExitWatcher {
+    int epollFd = -1;
+    size_t budget = 0;          ///< most pidfds open at once
+    std::map<int, int> pidfds;  ///< PID -> pidfd
+};
+
+bool openExitWatcher(ExitWatcher& watcher);
+void closeExitWatcher(ExitWatcher& watcher);
+bool watchProcess(ExitWatcher& watcher, int pid);
+void unwatchProcess(ExitWatcher& watcher, int pid);
+void waitExits(ExitWatcher& watcher, float interval, std::vector<int64_t>& uptimeBuffer,
+               ProcessTable& processBuffer, volatile sig_atomic_t& gSignalStatus,
+               std::vector<IntervalUnion>& parallelTracking);
+
+#endif //YOTTA_EXITWATCHER_HPP
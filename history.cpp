@@ -0,0 +1,621 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.hpp"
+#include "timebase.hpp"
+#include "util.hpp"
+
+/// Identifies the boot, changes at each boot
+const char* const BOOT_ID_FILE = "/proc/sys/kernel/random/boot_id";
+
+/// Reads the varints of a column one after the other
+struct VarintReader {
+    const unsigned char* position;
+    const unsigned char* end;
+
+    /**
+     * Read the next number
+     *
+     * @param value : filled with the number
+     *
+     * @return true  : if a whole number was read
+     *         false : if the column is over or cut
+     */
+    bool next(uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; position != end && shift < 64; shift += 7) {
+            unsigned char byte = *position++;
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * Read the next number, zigzag encoded
+     *
+     * @param value : filled with the number
+     *
+     * @return true  : if a whole number was read
+     *         false : if the column is over or cut
+     */
+    bool nextSigned(int64_t& value) {
+        uint64_t zigzag;
+        if (!next(zigzag))
+            return false;
+        value = (int64_t) (zigzag >> 1) ^ -(int64_t) (zigzag & 1);
+        return true;
+    }
+};
+
+
+/**
+ * Append a number to a column, 7 bits per byte, the high bit of a byte tells another one follows
+ *
+ * @param column : the column
+ * @param value : the number
+ */
+void appendVarint(std::string& column, uint64_t value) {
+    while (value >= 0x80) {
+        column += (char) (value | 0x80);
+        value >>= 7;
+    }
+    column += (char) value;
+}
+
+/**
+ * Append a signed number to a column, zigzag encoded so that a small negative number stays short
+ *
+ * @param column : the column
+ * @param value : the number
+ */
+void appendSigned(std::string& column, int64_t value) {
+    appendVarint(column, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+/**
+ * Whether a bucket is read by a query over a time range
+ *
+ * A day inside the range, or whose hours are not kept anymore, is read from its daily bucket, otherwise from its hours
+ *
+ * @param start : start of the bucket, in seconds since the epoch
+ * @param span : span of the bucket
+ * @param since : start of the range, in seconds since the epoch
+ * @param until : end of the range, in seconds since the epoch
+ * @param hourlySince : the days before only have a daily bucket, in seconds since the epoch
+ *
+ * @return true  : if the bucket is read
+ *         false : otherwise
+ */
+bool bucketWanted(int64_t start, uint32_t span, int64_t since, int64_t until, int64_t hourlySince) {
+    if (start >= until || start + span <= since)
+        return false;
+    int64_t day = start / DAY_BUCKET * DAY_BUCKET;
+    bool whole = day >= since && day + DAY_BUCKET <= until;
+    bool hourly = day + DAY_BUCKET > hourlySince;
+    return span == DAY_BUCKET ? whole || !hourly : !whole && hourly;
+}
+
+
+Segment::~Segment() {
+    if (data)
+        munmap((void*) data, length);
+}
+
+/**
+ * Map a segment in memory
+ *
+ * The header and the buckets are checked, the entries and the names are read when a bucket is collected
+ *
+ * @param path : path of the segment
+ *
+ * @return true  : if the segment is mapped
+ *         false : if it does not exist or is not a segment of this version
+ */
+bool Segment::open(const char* path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(SegmentHeader)) {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    data = (const char*) mapping;
+    length = st.st_size;
+    header = (const SegmentHeader*) data;
+    bool valid = memcmp(header->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0 && header->version == SEGMENT_VERSION &&
+                 header->ticksPerSecond != 0 &&
+                 sizeof(SegmentHeader) + header->bucketCount * sizeof(SegmentBucket) +
+                 header->entryCount * sizeof(SegmentEntry) + header->namesSize == length;
+    if (valid) {
+        bucketTable = (const SegmentBucket*) (data + sizeof(SegmentHeader));
+        entries = (const SegmentEntry*) (bucketTable + header->bucketCount);
+        names = (const char*) (entries + header->entryCount);
+        for (uint32_t bucket = 0; bucket < header->bucketCount && valid; ++bucket)
+            valid = bucketTable[bucket].firstEntry + bucketTable[bucket].entryCount <= header->entryCount;
+    }
+    if (!valid) {
+        munmap(mapping, length);
+        data = nullptr;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Header of the segment
+ *
+ * @return the header, the segment has to be open
+ */
+const SegmentHeader& Segment::info() const {
+    return *header;
+}
+
+/**
+ * Name of an entry
+ *
+ * @param entry : the entry
+ *
+ * @return the name, which points into the mapping, empty if it does not fit in the names
+ */
+std::string_view Segment::name(const SegmentEntry& entry) const {
+    if ((uint64_t) entry.nameOffset + entry.nameLength > header->namesSize)
+        return std::string_view();
+    return std::string_view(names + entry.nameOffset, entry.nameLength);
+}
+
+/**
+ * Pass the uptimes of a bucket
+ *
+ * @param bucket : index of the bucket
+ * @param names : names to look up in the bucket, all of them if empty
+ * @param add : called with each name and its uptime, in clock ticks of this host
+ */
+void Segment::collectBucket(uint32_t bucket, const std::vector<std::string>& names,
+                            const std::function<void (std::string_view, int64_t)>& add) const {
+    const SegmentEntry* first = entries + bucketTable[bucket].firstEntry;
+    const SegmentEntry* last = first + bucketTable[bucket].entryCount;
+    auto convert = [this] (int64_t uptime) {
+        if (header->ticksPerSecond != (uint64_t) ticksPerSecond())
+            uptime = uptime * ticksPerSecond() / header->ticksPerSecond;
+        return uptime;
+    };
+
+    if (names.empty()) {
+        for (const SegmentEntry* entry = first; entry != last; ++entry)
+            add(name(*entry), convert(entry->uptime));
+        return;
+    }
+    for (auto& wanted : names) {
+        const SegmentEntry* entry = std::lower_bound(first, last, wanted, [this] (const SegmentEntry& e, const std::string& n) {
+            return name(e) < n;
+        });
+        if (entry != last && name(*entry) == wanted)
+            add(wanted, convert(entry->uptime));
+    }
+}
+
+/**
+ * Pass the uptimes of the buckets that overlap a time range
+ *
+ * A day inside the range is read from its daily bucket, a day at an end of the range from its hours
+ * The range is thus rounded to whole hours, and to whole days for the days whose hours are not kept anymore
+ *
+ * @param since : start of the range, in seconds since the epoch
+ * @param until : end of the range, in seconds since the epoch
+ * @param names : names to look up, all of them if empty
+ * @param add : called with a name and an uptime, in clock ticks of this host, as many times as it has buckets
+ */
+void Segment::collect(int64_t since, int64_t until, const std::vector<std::string>& names,
+                      const std::function<void (std::string_view, int64_t)>& add) const {
+    // the hourly buckets come first, sorted by start
+    const SegmentBucket* hours = bucketTable;
+    const SegmentBucket* hoursEnd = std::partition_point(bucketTable, bucketTable + header->bucketCount,
+                                                         [] (const SegmentBucket& b) { return b.span == HOUR_BUCKET; });
+
+    for (const SegmentBucket* day = hoursEnd; day != bucketTable + header->bucketCount; ++day) {
+        if (day->span != DAY_BUCKET || day->start >= until || day->start + DAY_BUCKET <= since)
+            continue;
+        bool whole = day->start >= since && day->start + DAY_BUCKET <= until;
+        if (whole || day->start + DAY_BUCKET <= header->hourlySince) {
+            collectBucket(day - bucketTable, names, add);
+            continue;
+        }
+        int64_t from = std::max(day->start, since - (int64_t) HOUR_BUCKET + 1);
+        int64_t to = std::min(day->start + (int64_t) DAY_BUCKET, until);
+        const SegmentBucket* hour = std::lower_bound(hours, hoursEnd, from, [] (const SegmentBucket& b, int64_t start) {
+            return b.start < start;
+        });
+        for (; hour != hoursEnd && hour->start < to; ++hour)
+            collectBucket(hour - bucketTable, names, add);
+    }
+}
+
+/**
+ * Copy all the buckets of the segment
+ *
+ * @param buckets : filled with the buckets, uptimes in clock ticks of this host
+ */
+void Segment::buckets(HistoryBuckets& buckets) const {
+    for (uint32_t bucket = 0; bucket < header->bucketCount; ++bucket) {
+        BucketTotals& totals = buckets[{bucketTable[bucket].span, bucketTable[bucket].start}];
+        collectBucket(bucket, {}, [&totals] (std::string_view name, int64_t uptime) {
+            totals[std::string(name)] += uptime;
+        });
+    }
+}
+
+ColdSegment::~ColdSegment() {
+    if (data)
+        munmap((void*) data, length);
+}
+
+/**
+ * Map a cold segment in memory
+ *
+ * Only the header is checked, the columns are decoded when they are collected
+ *
+ * @param path : path of the cold segment
+ *
+ * @return true  : if the cold segment is mapped
+ *         false : if it does not exist or is not a cold segment of this version
+ */
+bool ColdSegment::open(const char* path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(ColdSegmentHeader)) {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    data = (const char*) mapping;
+    length = st.st_size;
+    header = (const ColdSegmentHeader*) data;
+    if (memcmp(header->magic, COLD_SEGMENT_MAGIC, sizeof(COLD_SEGMENT_MAGIC)) != 0 || header->version != SEGMENT_VERSION ||
+        header->ticksPerSecond == 0 || header->hourCount > header->bucketCount ||
+        sizeof(ColdSegmentHeader) + header->namesSize + header->startsSize + header->countsSize + header->idsSize +
+        header->uptimesSize != length) {
+        munmap(mapping, length);
+        data = nullptr;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Pass the uptimes of the buckets that overlap a time range
+ *
+ * The columns are decoded as they are read, only the dictionary and the last uptime of each name are kept,
+ * so the memory used does not depend on how many buckets the segment holds
+ * The buckets are chosen as in Segment::collect
+ *
+ * @param since : start of the range, in seconds since the epoch
+ * @param until : end of the range, in seconds since the epoch
+ * @param names : names to look up, all of them if empty
+ * @param add : called with a name and an uptime, in clock ticks of this host, as many times as it has buckets
+ */
+void ColdSegment::collect(int64_t since, int64_t until, const std::vector<std::string>& names,
+                          const std::function<void (std::string_view, int64_t)>& add) const {
+    const unsigned char* column = (const unsigned char*) data + sizeof(ColdSegmentHeader);
+    VarintReader dictionaryColumn{column, column + header->namesSize};
+    column += header->namesSize;
+    VarintReader starts{column, column + header->startsSize};
+    column += header->startsSize;
+    VarintReader counts{column, column + header->countsSize};
+    column += header->countsSize;
+    VarintReader ids{column, column + header->idsSize};
+    column += header->idsSize;
+    VarintReader uptimes{column, column + header->uptimesSize};
+
+    std::vector<std::string_view> dictionary;
+    dictionary.reserve(header->nameCount);
+    uint64_t size;
+    while (dictionary.size() < header->nameCount && dictionaryColumn.next(size)) {
+        if (size > (uint64_t) (dictionaryColumn.end - dictionaryColumn.position))
+            return;
+        dictionary.emplace_back((const char*) dictionaryColumn.position, size);
+        dictionaryColumn.position += size;
+    }
+    if (dictionary.size() != header->nameCount)
+        return;
+
+    std::vector<char> wanted(dictionary.size(), names.empty());
+    for (auto& name : names) {
+        auto found = std::lower_bound(dictionary.begin(), dictionary.end(), name);
+        if (found != dictionary.end() && *found == name)
+            wanted[found - dictionary.begin()] = true;
+    }
+
+    // last uptime of each name, in the hourly and in the daily buckets
+    std::vector<int64_t> previous[2] = {std::vector<int64_t>(dictionary.size()), std::vector<int64_t>(dictionary.size())};
+    int64_t start = 0;
+    for (uint32_t bucket = 0; bucket < header->bucketCount; ++bucket) {
+        int64_t startDelta;
+        uint64_t count;
+        if (!starts.nextSigned(startDelta) || !counts.next(count))
+            return;
+        start += startDelta;
+        uint32_t span = bucket < header->hourCount ? HOUR_BUCKET : DAY_BUCKET;
+        bool read = bucketWanted(start, span, since, until, header->hourlySince);
+
+        uint64_t id = 0;
+        for (uint64_t entry = 0; entry < count; ++entry) {
+            uint64_t idDelta;
+            int64_t uptimeDelta;
+            if (!ids.next(idDelta) || !uptimes.nextSigned(uptimeDelta))
+                return;
+            id += idDelta;
+            if (id >= dictionary.size())
+                return;
+            int64_t& uptime = previous[span == DAY_BUCKET][id];
+            uptime += uptimeDelta;
+            if (read && wanted[id]) {
+                int64_t converted = uptime;
+                if (header->ticksPerSecond != (uint64_t) ticksPerSecond())
+                    converted = converted * ticksPerSecond() / header->ticksPerSecond;
+                add(dictionary[id], converted);
+            }
+        }
+    }
+}
+
+/**
+ * Identifier of the current boot
+ *
+ * @return the boot_id of the kernel, empty if it can not be read
+ */
+std::string bootId() {
+    std::ifstream file(BOOT_ID_FILE);
+    std::string id;
+    std::getline(file, id);
+    trim(id);
+    return id;
+}
+
+/**
+ * Path of the segment of a boot
+ *
+ * @param bootId : boot_id of the boot
+ *
+ * @return the path of the segment
+ */
+std::string segmentPath(std::string_view bootId) {
+    return std::string(HISTORY_DIR) + "/" + std::string(bootId) + ".seg";
+}
+
+/**
+ * Path of the cold segment of a boot
+ *
+ * @param bootId : boot_id of the boot
+ *
+ * @return the path of the cold segment
+ */
+std::string coldSegmentPath(std::string_view bootId) {
+    return std::string(HISTORY_DIR) + "/" + std::string(bootId) + ".cold";
+}
+
+/**
+ * Write a file next to its path and rename it over
+ *
+ * @param path : path of the file
+ * @param parts : content of the file, written one after the other
+ *
+ * @return true  : if the file was written
+ *         false : otherwise
+ */
+bool replaceFile(const std::string& path, const std::vector<std::pair<const void*, size_t>>& parts) {
+    std::error_code ignored;
+    std::filesystem::create_directories(HISTORY_DIR, ignored);
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = true;
+    for (auto& part : parts)
+        written = written && write(fd, part.first, part.second) == (ssize_t) part.second;
+    written = written && fsync(fd) == 0;
+    close(fd);
+    if (!written || rename(temporary.c_str(), path.c_str()) < 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Write the segment of a boot
+ *
+ * The counts and sizes of the header are filled from the buckets, the names shared by several buckets are stored once
+ *
+ * @param header : header of the segment, with the boot and the time covered
+ * @param buckets : buckets of the boot, uptimes in clock ticks
+ *
+ * @return true  : if the segment was written
+ *         false : otherwise
+ */
+bool writeSegment(const SegmentHeader& header, const HistoryBuckets& buckets) {
+    SegmentHeader written = header;
+    memcpy(written.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    written.version = SEGMENT_VERSION;
+    written.ticksPerSecond = ticksPerSecond();
+
+    std::vector<SegmentBucket> bucketTable;
+    std::vector<SegmentEntry> entries;
+    std::string names;
+    std::map<std::string_view, uint32_t> nameOffsets;
+    for (auto& bucket : buckets) {
+        SegmentBucket segmentBucket{bucket.first.second, bucket.first.first, 0, entries.size()};
+        for (auto& total : bucket.second) {
+            if (total.second == 0)
+                continue;
+            auto offset = nameOffsets.try_emplace(total.first, names.size());
+            if (offset.second)
+                names += total.first;
+            entries.push_back({total.second, offset.first->second, (uint32_t) total.first.size()});
+            ++segmentBucket.entryCount;
+        }
+        if (segmentBucket.entryCount != 0)
+            bucketTable.push_back(segmentBucket);
+    }
+    written.bucketCount = bucketTable.size();
+    written.entryCount = entries.size();
+    written.namesSize = names.size();
+
+    return replaceFile(segmentPath(written.bootId), {{&written, sizeof(written)},
+                                                      {bucketTable.data(), bucketTable.size() * sizeof(SegmentBucket)},
+                                                      {entries.data(), entries.size() * sizeof(SegmentEntry)},
+                                                      {names.data(), names.size()}});
+}
+
+/**
+ * Read the history index
+ *
+ * @param boots : filled with the boots that have a segment, sorted by boot time
+ *
+ * @return true  : if the index was read
+ *         false : if it does not exist or is not an index of this version
+ */
+bool readHistoryIndex(std::vector<HistoryIndexEntry>& boots) {
+    std::ifstream file(HISTORY_INDEX_FILE, std::ios::binary);
+    HistoryIndexHeader header{};
+    if (!file.read((char*) &header, sizeof(header)) ||
+        memcmp(header.magic, HISTORY_INDEX_MAGIC, sizeof(HISTORY_INDEX_MAGIC)) != 0 || header.version != SEGMENT_VERSION)
+        return false;
+    boots.resize(header.count);
+    if (!file.read((char*) boots.data(), header.count * sizeof(HistoryIndexEntry))) {
+        boots.clear();
+        return false;
+    }
+    for (auto& boot : boots)
+        boot.bootId[sizeof(boot.bootId) - 1] = '\0';
+    return true;
+}
+
+/**
+ * Add a segment to the history index, or update the time it covers
+ *
+ * @param header : header of the segment
+ *
+ * @return true  : if the index was written
+ *         false : otherwise
+ */
+bool indexSegment(const SegmentHeader& header) {
+    std::vector<HistoryIndexEntry> boots;
+    readHistoryIndex(boots);
+    auto boot = std::find_if(boots.begin(), boots.end(), [&header] (const HistoryIndexEntry& entry) {
+        return strncmp(entry.bootId, header.bootId, sizeof(entry.bootId)) == 0;
+    });
+    if (boot == boots.end()) {
+        boots.emplace_back();
+        boot = boots.end() - 1;
+        memcpy(boot->bootId, header.bootId, sizeof(boot->bootId));
+    }
+    boot->bootTime = header.bootTime;
+    boot->endTime = header.endTime;
+    std::sort(boots.begin(), boots.end(), [] (const HistoryIndexEntry& a, const HistoryIndexEntry& b) {
+        return a.bootTime < b.bootTime;
+    });
+
+    HistoryIndexHeader indexHeader{};
+    memcpy(indexHeader.magic, HISTORY_INDEX_MAGIC, sizeof(HISTORY_INDEX_MAGIC));
+    indexHeader.version = SEGMENT_VERSION;
+    indexHeader.count = boots.size();
+    return replaceFile(HISTORY_INDEX_FILE, {{&indexHeader, sizeof(indexHeader)},
+                                            {boots.data(), boots.size() * sizeof(HistoryIndexEntry)}});
+}
+
+/**
+ * Replace the segment of a boot by a cold segment
+ *
+ * The buckets are kept as they are, a query gives the same uptimes from both
+ *
+ * @param bootId : boot_id of the boot, its segment must not be written anymore
+ *
+ * @return true  : if the cold segment was written and the segment removed
+ *         false : otherwise, the segment is kept
+ */
+bool compactSegment(std::string_view bootId) {
+    Segment segment;
+    if (!segment.open(segmentPath(bootId).c_str()))
+        return false;
+    HistoryBuckets buckets;
+    segment.buckets(buckets);
+
+    std::map<std::string_view, uint32_t> dictionary;
+    for (auto& bucket : buckets) {
+        for (auto& total : bucket.second)
+            dictionary.emplace(total.first, 0);
+    }
+    ColdSegmentHeader header{};
+    std::string names;
+    for (auto& name : dictionary) {
+        name.second = header.nameCount++;
+        appendVarint(names, name.first.size());
+        names += name.first;
+    }
+
+    std::string starts, counts, ids, uptimes;
+    std::vector<int64_t> previous[2] = {std::vector<int64_t>(dictionary.size()), std::vector<int64_t>(dictionary.size())};
+    int64_t start = 0;
+    for (auto& bucket : buckets) {
+        uint32_t span = bucket.first.first;
+        if (span == HOUR_BUCKET)
+            ++header.hourCount;
+        ++header.bucketCount;
+        appendSigned(starts, bucket.first.second - start);
+        start = bucket.first.second;
+        appendVarint(counts, bucket.second.size());
+        // the totals are sorted by name, so are the IDs
+        uint32_t id = 0;
+        for (auto& total : bucket.second) {
+            uint32_t nameId = dictionary[total.first];
+            appendVarint(ids, nameId - id);
+            id = nameId;
+            int64_t& uptime = previous[span == DAY_BUCKET][nameId];
+            appendSigned(uptimes, total.second - uptime);
+            uptime = total.second;
+        }
+    }
+
+    memcpy(header.magic, COLD_SEGMENT_MAGIC, sizeof(COLD_SEGMENT_MAGIC));
+    header.version = SEGMENT_VERSION;
+    header.ticksPerSecond = ticksPerSecond();
+    header.namesSize = names.size();
+    header.startsSize = starts.size();
+    header.countsSize = counts.size();
+    header.idsSize = ids.size();
+    header.uptimesSize = uptimes.size();
+    header.bootTime = segment.info().bootTime;
+    header.endTime = segment.info().endTime;
+    header.hourlySince = segment.info().hourlySince;
+    memcpy(header.bootId, segment.info().bootId, sizeof(header.bootId));
+
+    if (!replaceFile(coldSegmentPath(bootId), {{&header, sizeof(header)}, {names.data(), names.size()},
+                                               {starts.data(), starts.size()}, {counts.data(), counts.size()},
+                                               {ids.data(), ids.size()}, {uptimes.data(), uptimes.size()}}))
+        return false;
+    unlink(segmentPath(bootId).c_str());
+    return true;
+}
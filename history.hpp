@@ -0,0 +1,176 @@
+#ifndef YOTTA_HISTORY_HPP
+#define YOTTA_HISTORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// Segments of the history, one per boot, named after the boot_id
+const char* const HISTORY_DIR = "/var/lib/yotta/history";
+
+/// Which boot each segment holds and the time it covers, so that a query only opens the segments it needs
+const char* const HISTORY_INDEX_FILE = "/var/lib/yotta/history/index";
+
+/// Identifies a segment file
+const char SEGMENT_MAGIC[4] = {'Y', 'T', 'H', 'S'};
+
+/// Version of the segment format, a segment of another version is not read
+const uint16_t SEGMENT_VERSION = 1;
+
+/// Span of the buckets, in seconds
+const uint32_t HOUR_BUCKET = 3600;
+const uint32_t DAY_BUCKET = 86400;
+
+/// How long the hourly buckets are kept, older hours are only left in the daily buckets, in seconds
+const int64_t HOURLY_RETENTION = 7 * DAY_BUCKET;
+
+/**
+ * Start of a segment file
+ *
+ * It is followed by the buckets, which are the index of the segment, then by the entries and the names they point into
+ * The file is written and read on the same host, numbers are in its byte order
+ */
+struct SegmentHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t padding;
+    uint32_t ticksPerSecond;  ///< clock ticks per second of the host that wrote the uptimes
+    uint32_t bucketCount;
+    uint64_t entryCount;
+    uint64_t namesSize;       ///< size of the names, in bytes
+    int64_t bootTime;         ///< when the boot started, in seconds since the epoch
+    int64_t endTime;          ///< end of the time the buckets cover, in seconds since the epoch
+    int64_t hourlySince;      ///< the days before only have a daily bucket, in seconds since the epoch
+    char bootId[40];          ///< boot_id of the boot, nul terminated
+};
+
+/// Bucket of a segment, its entries follow each other and are sorted by name
+struct SegmentBucket {
+    int64_t start;        ///< in seconds since the epoch, a multiple of the span
+    uint32_t span;        ///< HOUR_BUCKET or DAY_BUCKET, a day holds the uptimes of its hours too
+    uint32_t entryCount;
+    uint64_t firstEntry;
+};
+
+/// Uptime of a name during a bucket
+struct SegmentEntry {
+    int64_t uptime;       ///< in clock ticks
+    uint32_t nameOffset;  ///< where the name starts, from the start of the names
+    uint32_t nameLength;
+};
+
+/// Identifies a cold segment file
+const char COLD_SEGMENT_MAGIC[4] = {'Y', 'T', 'H', 'C'};
+
+/**
+ * Start of a cold segment file, a segment of a boot over for cold_segment_age days, compressed
+ *
+ * It is followed by columns, one after the other:
+ * - names : the dictionary, sorted, each name preceded by its length, a name is then referred to by its rank
+ * - starts : start of each bucket, minus the start of the previous one, the hourly buckets first
+ * - counts : number of entries of each bucket
+ * - ids : name of each entry, minus the name of the previous entry of the bucket
+ * - uptimes : uptime of each entry, minus the uptime of the name in the previous bucket of the same span
+ * All the numbers of the columns are varints, the signed ones zigzag encoded
+ */
+struct ColdSegmentHeader {
+    char magic[4];
+    uint16_t version;         ///< SEGMENT_VERSION
+    uint16_t padding;
+    uint32_t ticksPerSecond;  ///< clock ticks per second of the host that wrote the uptimes
+    uint32_t nameCount;
+    uint32_t hourCount;       ///< number of hourly buckets
+    uint32_t bucketCount;
+    uint64_t namesSize;       ///< sizes of the columns, in bytes
+    uint64_t startsSize;
+    uint64_t countsSize;
+    uint64_t idsSize;
+    uint64_t uptimesSize;
+    int64_t bootTime;         ///< as in the segment
+    int64_t endTime;
+    int64_t hourlySince;
+    char bootId[40];
+};
+
+/// Identifies the history index
+const char HISTORY_INDEX_MAGIC[4] = {'Y', 'T', 'H', 'I'};
+
+/// Start of the history index, followed by its entries sorted by boot time
+struct HistoryIndexHeader {
+    char magic[4];
+    uint16_t version;     ///< SEGMENT_VERSION
+    uint16_t padding;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/// Entry of the history index
+struct HistoryIndexEntry {
+    char bootId[40];      ///< nul terminated
+    int64_t bootTime;     ///< in seconds since the epoch
+    int64_t endTime;      ///< end of the time the segment covers, in seconds since the epoch
+};
+
+/// Uptime of each name during a bucket, in clock ticks
+using BucketTotals = std::map<std::string, int64_t, std::less<>>;
+
+/// Buckets of a boot, by span then start
+using HistoryBuckets = std::map<std::pair<uint32_t, int64_t>, BucketTotals>;
+
+/// Segment mapped read-only in memory
+struct Segment {
+    Segment() = default;
+    ~Segment();
+    Segment(const Segment&) = delete;
+    Segment& operator= (const Segment&) = delete;
+
+    bool open(const char* path);
+    const SegmentHeader& info() const;
+    void collect(int64_t since, int64_t until, const std::vector<std::string>& names,
+                 const std::function<void (std::string_view, int64_t)>& add) const;
+    void buckets(HistoryBuckets& buckets) const;
+
+private:
+    void collectBucket(uint32_t bucket, const std::vector<std::string>& names,
+                       const std::function<void (std::string_view, int64_t)>& add) const;
+    std::string_view name(const SegmentEntry& entry) const;
+
+    const char* data = nullptr;
+    size_t length = 0;
+    const SegmentHeader* header = nullptr;
+    const SegmentBucket* bucketTable = nullptr;
+    const SegmentEntry* entries = nullptr;
+    const char* names = nullptr;
+};
+
+/// Cold segment mapped read-only in memory, decoded while it is read
+struct ColdSegment {
+    ColdSegment() = default;
+    ~ColdSegment();
+    ColdSegment(const ColdSegment&) = delete;
+    ColdSegment& operator= (const ColdSegment&) = delete;
+
+    bool open(const char* path);
+    void collect(int64_t since, int64_t until, const std::vector<std::string>& names,
+                 const std::function<void (std::string_view, int64_t)>& add) const;
+
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+    const ColdSegmentHeader* header = nullptr;
+};
+
+std::string bootId();
+std::string segmentPath(std::string_view bootId);
+std::string coldSegmentPath(std::string_view bootId);
+bool compactSegment(std::string_view bootId);
+bool writeSegment(const SegmentHeader& header, const HistoryBuckets& buckets);
+bool readHistoryIndex(std::vector<HistoryIndexEntry>& boots);
+bool indexSegment(const SegmentHeader& header);
+
+#endif //YOTTA_HISTORY_HPP
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+
+#include "intervalUnion.hpp"
+
+
+/**
+ * Add an interval to the union
+ *
+ * Only the intervals that overlap the new one are visited, and they are merged into it
+ *
+ * @param start : start of the interval, in clock ticks since boot
+ * @param end : end of the interval, in clock ticks since boot
+ *
+ * @return the time the interval adds to the union, in clock ticks
+ */
+int64_t IntervalUnion::add (int64_t start, int64_t end) {
+    if (end <= start)
+        return 0;
+
+    // the first interval that may overlap is the last one starting before the new one
+    auto it = intervals.upper_bound(start);
+    if (it != intervals.begin() && std::prev(it)->second >= start)
+        --it;
+
+    int64_t covered = 0;
+    int64_t unionStart = start;
+    int64_t unionEnd = end;
+    while (it != intervals.end() && it->first <= end) {
+        covered += std::min(it->second, end) - std::max(it->first, start);
+        unionStart = std::min(unionStart, it->first);
+        unionEnd = std::max(unionEnd, it->second);
+        it = intervals.erase(it);
+    }
+    intervals.emplace_hint(it, unionStart, unionEnd);
+    return end - start - covered;
+}
+
+/**
+ * Forget the intervals that end before a time
+ *
+ * Once no process that is running or will run can have started before the horizon,
+ * nothing added to the union can overlap them anymore
+ *
+ * @param horizon : the time, in clock ticks since boot
+ */
+void IntervalUnion::compact (int64_t horizon) {
+    auto it = intervals.begin();
+    while (it != intervals.end() && it->second < horizon)
+        it = intervals.erase(it);
+}
+
+size_t IntervalUnion::size () const {
+    return intervals.size();
+}
+
+/**
+ * The disjoint intervals of the union
+ *
+ * @return start -> end of each interval, sorted by start, in clock ticks since boot
+ */
+const std::map<int64_t, int64_t>& IntervalUnion::spans () const {
+    return intervals;
+}
@@ -0,0 +1,23 @@
+#ifndef YOTTA_INTERVALUNION_HPP
+#define YOTTA_INTERVALUNION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+/**
+ * Union of the time intervals during which processes of one name were running
+ *
+ * Kept as disjoint intervals sorted by start, overlapping or touching intervals are merged when added
+ */
+struct IntervalUnion {
+    int64_t add (int64_t start, int64_t end);
+    void compact (int64_t horizon);
+    size_t size () const;
+    const std::map<int64_t, int64_t>& spans () const;
+
+private:
+    std::map<int64_t, int64_t> intervals;  ///< start -> end, in clock ticks since boot
+};
+
+#endif //YOTTA_INTERVALUNION_HPP
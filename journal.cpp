@@ -0,0 +1,525 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "database.hpp"
+#include "journal.hpp"
+#include "log.h"
+#include "timebase.hpp"
+#include "util.hpp"
+
+/// Bytes of a record before its name
+const size_t RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint16_t) + 2 * sizeof(int64_t);
+
+/// Records not written yet, filled by the tracking thread
+std::string pendingRecords;
+
+/// Bytes of records ever appended to pendingRecords, it holds those after flushedBytes
+uint64_t appendedBytes = 0;
+
+/// Bytes of records ever taken out of pendingRecords, to the journal file
+uint64_t flushedBytes = 0;
+
+/// Bytes of records counted by the last snapshot published, only those are written before a rotation
+uint64_t publishedBytes = 0;
+
+/// Protects pendingRecords, the byte counts, currentSequence and journalStopping, only held to move records in or out
+std::mutex pendingRecordsMutex;
+
+/// Wakes the journal thread up when enough records wait or when it has to stop
+std::condition_variable journalWake;
+
+/// Whether the journal thread has to stop
+bool journalStopping = false;
+
+/// Protects the journal file, held while it is written
+std::mutex journalFileMutex;
+
+/// The journal file, opened for appending, -1 if it could not be created
+int journalFd = -1;
+
+/// Sequence number of the journal the pending records belong to
+uint64_t currentSequence = 0;
+
+/// Sequence number of the journal file, behind currentSequence between a rotation and the start of the next journal
+uint64_t fileSequence = 0;
+
+/// Size of the journal file, in bytes
+size_t journalSize = 0;
+
+/// Size of the journal file after it was last compacted, in bytes
+size_t compactedSize = 0;
+
+
+/**
+ * Checksum of the end of a record
+ *
+ * FNV-1a, enough to tell a record cut by a crash from a whole one
+ *
+ * @param data : the record, after its checksum
+ * @param size : its size
+ *
+ * @return the checksum
+ */
+uint32_t recordChecksum (const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Append a record to a buffer
+ *
+ * @param records : the buffer
+ * @param name : name of the process
+ * @param uptime : its uptime, in clock ticks
+ * @param startTime : its start time since boot, in clock ticks
+ */
+void appendRecord (std::string& records, std::string_view name, int64_t uptime, int64_t startTime) {
+    uint16_t length = std::min<size_t>(name.size(), UINT16_MAX);
+    size_t start = records.size();
+    records.append(sizeof(uint32_t), '\0');
+    records.append((const char*) &length, sizeof(length));
+    records.append((const char*) &uptime, sizeof(uptime));
+    records.append((const char*) &startTime, sizeof(startTime));
+    records.append(name.data(), length);
+    uint32_t checksum = recordChecksum(records.data() + start + sizeof(uint32_t), records.size() - start - sizeof(uint32_t));
+    memcpy(records.data() + start, &checksum, sizeof(checksum));
+}
+
+/**
+ * Read a journal file and add up the uptimes of its records
+ *
+ * The records after one that is cut or corrupted are left out, they were never synced
+ * The processes started before the checkpoint the journal follows are kept apart, they were running when it was
+ * taken
+ *
+ * @param header : filled with the header of the journal
+ * @param totals : the uptime of each record of a process started after the checkpoint is added to the total of its
+ *                 name, in clock ticks of this host
+ * @param earlier : filled with the records of the processes started before the checkpoint
+ *
+ * @return true  : if the file is a journal of this version
+ *         false : otherwise
+ */
+bool readJournal (JournalHeader& header, std::map<std::string, int64_t, std::less<>>& totals,
+                  std::vector<EarlierRecord>& earlier) {
+    int fd = open(JOURNAL_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    std::string content;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        content.append(buf, n);
+    close(fd);
+
+    if (content.size() < sizeof(header))
+        return false;
+    memcpy(&header, content.data(), sizeof(header));
+    if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 || header.version != JOURNAL_VERSION ||
+        header.ticksPerSecond == 0)
+        return false;
+
+    size_t offset = sizeof(header);
+    while (content.size() - offset >= RECORD_HEADER_SIZE) {
+        uint32_t checksum;
+        uint16_t length;
+        int64_t uptime;
+        int64_t startTime;
+        memcpy(&checksum, content.data() + offset, sizeof(checksum));
+        memcpy(&length, content.data() + offset + sizeof(checksum), sizeof(length));
+        memcpy(&uptime, content.data() + offset + sizeof(checksum) + sizeof(length), sizeof(uptime));
+        memcpy(&startTime, content.data() + offset + sizeof(checksum) + sizeof(length) + sizeof(uptime), sizeof(startTime));
+        size_t size = RECORD_HEADER_SIZE + length;
+        if (content.size() - offset < size ||
+            recordChecksum(content.data() + offset + sizeof(checksum), size - sizeof(checksum)) != checksum)
+            break;
+
+        if (header.ticksPerSecond != (uint64_t) ticksPerSecond())
+            uptime = uptime * ticksPerSecond() / header.ticksPerSecond;
+        std::string name(content.data() + offset + RECORD_HEADER_SIZE, length);
+        if (startTime >= header.checkpointTime)
+            totals[name] += uptime;
+        else
+            earlier.push_back({std::move(name), uptime, startTime});
+        offset += size;
+    }
+    return true;
+}
+
+/**
+ * Replace the journal file by a new one
+ *
+ * The new journal is written next to it then renamed, there is always a whole journal on the disk
+ * Has to be called with journalFileMutex held
+ *
+ * @param newSequence : sequence number of the new journal
+ * @param checkpointTime : time since boot of the checkpoint the journal follows, 0 if it follows a save
+ * @param records : records the new journal starts with
+ *
+ * @return true  : if the journal was replaced
+ *         false : if the previous one is kept
+ */
+bool createJournal (uint64_t newSequence, int64_t checkpointTime, const std::string& records) {
+    JournalHeader header{};
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    header.version = JOURNAL_VERSION;
+    header.ticksPerSecond = ticksPerSecond();
+    header.sequence = newSequence;
+    header.checkpointTime = checkpointTime;
+
+    std::string temporary = std::string(JOURNAL_FILE) + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error("Creating the journal", ERROR);
+        return false;
+    }
+    bool written = write(fd, &header, sizeof(header)) == sizeof(header) &&
+                   write(fd, records.data(), records.size()) == (ssize_t) records.size() &&
+                   fdatasync(fd) == 0;
+    if (!written || rename(temporary.c_str(), JOURNAL_FILE) < 0) {
+        error("Creating the journal", ERROR);
+        close(fd);
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    // the descriptor follows the file through the rename
+    if (journalFd >= 0)
+        close(journalFd);
+    journalFd = fd;
+    fileSequence = newSequence;
+    journalSize = sizeof(header) + records.size();
+    return true;
+}
+
+/**
+ * Go on appending to the journal left by the previous run, instead of starting a new one
+ *
+ * @param header : header of that journal
+ */
+void appendJournal (const JournalHeader& header) {
+    journalFd = open(JOURNAL_FILE, O_WRONLY | O_APPEND | O_CLOEXEC);
+    currentSequence = fileSequence = header.sequence;
+    journalSize = std::filesystem::file_size(JOURNAL_FILE);
+}
+
+/**
+ * Fold the checkpoint and the journal left by the previous run into the database and start a new journal
+ *
+ * Called at startup, before anything is tracked
+ * A checkpoint or a journal already folded, whose sequence number is not after the one of the database, is skipped
+ * A checkpoint holds the journals up to its sequence number and the finished processes, only the journal right after
+ * it is added to it
+ * The processes running at the checkpoint are in its state, those the journal saw finish are counted from it and
+ * have to be left out of that state
+ * The state of a stop holds the uptimes of the journals up to its sequence number, they are not folded and the
+ * daemon restoring it goes on appending to the journal it holds, which is replayed if the daemon crashes
+ * If the database can not be written, the daemon goes on appending to the journal left
+ *
+ * @param ended : filled with the records of the processes running at the checkpoint folded that finished after it
+ * @param stateSequence : journal whose uptimes the state of the stop restored holds, 0 if none was
+ *
+ * @return the sequence number of the checkpoint folded, which its state has to hold, 0 if none was
+ */
+uint64_t replayJournal (std::vector<EarlierRecord>& ended, uint64_t stateSequence) {
+    std::lock_guard<std::mutex> lock(journalFileMutex);
+    Database database;
+    bool hasDatabase = database.open(DATABASE_FILE);
+    if (!hasDatabase && std::filesystem::exists(DATABASE_FILE)) {
+        std::string errmsg = "Not a database of this version : " + std::string(DATABASE_FILE);
+        error(errmsg.c_str(), ERROR);
+    }
+    uint64_t folded = std::max(database.journalSequence(), stateSequence);
+    uint64_t replayed = folded;
+    std::map<std::string, int64_t, std::less<>> totals;
+
+    Database checkpoint;
+    bool hasCheckpoint = checkpoint.open(CHECKPOINT_FILE) && checkpoint.journalSequence() > folded;
+    if (hasCheckpoint) {
+        for (size_t entry = 0; entry < checkpoint.size(); ++entry)
+            totals[std::string(checkpoint.name(entry))] += checkpoint.total(entry);
+        replayed = checkpoint.journalSequence();
+    }
+
+    JournalHeader header{};
+    std::map<std::string, int64_t, std::less<>> journalTotals;
+    std::vector<EarlierRecord> earlier;
+    bool hasJournal = readJournal(header, journalTotals, earlier);
+    if (hasJournal && header.sequence > replayed) {
+        for (auto& record : earlier)
+            journalTotals[record.name] += record.uptime;
+        for (auto& total : journalTotals)
+            totals[total.first] += total.second;
+        if (hasCheckpoint && header.sequence == replayed + 1)
+            ended = std::move(earlier);
+        replayed = header.sequence;
+    }
+
+    if (replayed > folded) {
+        bool written = false;
+        if (hasDatabase || !std::filesystem::exists(DATABASE_FILE)) {
+            for (size_t entry = 0; entry < database.size(); ++entry)
+                totals[std::string(database.name(entry))] += database.total(entry);
+            std::vector<std::pair<std::string, int64_t>> entries(totals.begin(), totals.end());
+            written = writeDatabase(DATABASE_FILE, std::move(entries), replayed);
+        }
+        if (!written) {
+            error("Replaying the journal, its records are kept", ERROR);
+            ended.clear();
+            if (hasJournal) {
+                appendJournal(header);
+                return 0;
+            }
+            hasCheckpoint = false;
+        }
+        folded = replayed;
+    } else if (hasJournal && stateSequence != 0 && header.sequence == stateSequence) {
+        appendJournal(header);
+        return 0;
+    }
+    currentSequence = std::max(folded, hasJournal ? header.sequence : 0) + 1;
+    createJournal(currentSequence, 0, std::string());
+    return hasCheckpoint ? checkpoint.journalSequence() : 0;
+}
+
+/**
+ * Record the uptime of a process that has just finished
+ *
+ * Only buffered, the journal thread writes it once a published snapshot counts it
+ *
+ * @param name : name of the process
+ * @param uptime : its uptime, in clock ticks
+ * @param startTime : its start time since boot, in clock ticks
+ */
+void journalUptime (std::string_view name, int64_t uptime, int64_t startTime) {
+    std::lock_guard<std::mutex> lock(pendingRecordsMutex);
+    size_t size = pendingRecords.size();
+    appendRecord(pendingRecords, name, uptime, startTime);
+    appendedBytes += pendingRecords.size() - size;
+}
+
+/**
+ * Where the journal is at, for the snapshot the tracking thread is about to publish
+ *
+ * @return the bytes of records appended so far, all counted by the snapshot
+ */
+uint64_t journalMark () {
+    std::lock_guard<std::mutex> lock(pendingRecordsMutex);
+    return appendedBytes;
+}
+
+/**
+ * Let the journal thread write the records counted by a snapshot, once it is published
+ *
+ * A record is only written once a snapshot counts it, a checkpoint then splits the journal where its snapshot does
+ *
+ * @param mark : journalMark of the snapshot
+ */
+void markPublished (uint64_t mark) {
+    std::lock_guard<std::mutex> lock(pendingRecordsMutex);
+    publishedBytes = mark;
+    if (publishedBytes >= flushedBytes + JOURNAL_BATCH_SIZE)
+        journalWake.notify_one();
+}
+
+/**
+ * Write the records waiting up to a point and sync them
+ *
+ * Has to be called with journalFileMutex held
+ * Between a rotation and the start of the next journal, the records wait for the new file
+ *
+ * @param limit : the records appended after that many bytes are left waiting
+ */
+void writeRecords (uint64_t limit) {
+    std::string records;
+    {
+        std::lock_guard<std::mutex> pendingLock(pendingRecordsMutex);
+        if (currentSequence != fileSequence || limit <= flushedBytes)
+            return;
+        size_t size = std::min(limit, appendedBytes) - flushedBytes;
+        if (size == pendingRecords.size()) {
+            records.swap(pendingRecords);
+        } else {
+            records = pendingRecords.substr(0, size);
+            pendingRecords.erase(0, size);
+        }
+        flushedBytes += size;
+    }
+    if (records.empty() || journalFd < 0)
+        return;
+    if (write(journalFd, records.data(), records.size()) != (ssize_t) records.size() || fdatasync(journalFd) < 0)
+        error("Writing the journal", ERROR);
+    journalSize += records.size();
+}
+
+/**
+ * Write the records counted by a published snapshot, all of them once the journal stops
+ */
+void flushJournal () {
+    std::lock_guard<std::mutex> lock(journalFileMutex);
+    uint64_t limit;
+    {
+        std::lock_guard<std::mutex> pendingLock(pendingRecordsMutex);
+        limit = journalStopping ? appendedBytes : publishedBytes;
+    }
+    writeRecords(limit);
+}
+
+/**
+ * Write and sync all the records waiting, once the tracking thread stopped
+ *
+ * @return the sequence number of the journal they are in, the state of the stop holds its uptimes
+ */
+uint64_t syncJournal () {
+    std::lock_guard<std::mutex> lock(journalFileMutex);
+    writeRecords(UINT64_MAX);
+    std::lock_guard<std::mutex> pendingLock(pendingRecordsMutex);
+    return fileSequence;
+}
+
+/**
+ * Close the journal before the uptimes of the buffers are saved elsewhere
+ *
+ * Only once the tracking thread stopped: all the records waiting are written and synced, the ones recorded from
+ * now on belong to the next journal
+ * Has to be followed by startJournal once the uptimes are saved, or by cancelRotation if they could not be
+ *
+ * @return the sequence number of the journal closed, the database saving its uptimes stores it
+ */
+uint64_t rotateJournal () {
+    std::lock_guard<std::mutex> lock(journalFileMutex);
+    writeRecords(UINT64_MAX);
+    std::lock_guard<std::mutex> pendingLock(pendingRecordsMutex);
+    return currentSequence++;
+}
+
+/**
+ * Close the journal where a snapshot is, before its uptimes are saved elsewhere
+ *
+ * The snapshot is taken while no record can be written, the records it counts are written and synced and those
+ * after it belong to the next journal
+ * The journal thread only writes the records of published snapshots, none after the mark can be in the file yet
+ * Has to be followed by startJournal once the uptimes are saved, or by cancelRotation if they could not be
+ *
+ * @param takeSnapshot : takes the snapshot and returns its journalMark
+ *
+ * @return the sequence number of the journal closed, the checkpoint saving the uptimes of the snapshot stores it
+ */
+uint64_t rotateJournal (const std::function<uint64_t ()>& takeSnapshot) {
+    std::lock_guard<std::mutex> lock(journalFileMutex);
+    writeRecords(takeSnapshot());
+    std::lock_guard<std::mutex> pendingLock(pendingRecordsMutex);
+    return currentSequence++;
+}
+
+/**
+ * Go on with the journal closed by rotateJournal, its uptimes could not be saved
+ *
+ * The records recorded meanwhile are appended to it
+ */
+void cancelRotation () {
+    std::lock_guard<std::mutex> lock(pendingRecordsMutex);
+    currentSequence = fileSequence;
+}
+
+/**
+ * Start the next journal once the one closed by rotateJournal is saved
+ *
+ * The records recorded since the rotation are its first ones
+ *
+ * @param checkpointTime : time since boot of the checkpoint that saved the uptimes, 0 for a save
+ */
+void startJournal (int64_t checkpointTime) {
+    std::lock_guard<std::mutex> lock(journalFileMutex);
+    std::string records;
+    uint64_t newSequence;
+    {
+        std::lock_guard<std::mutex> pendingLock(pendingRecordsMutex);
+        records.swap(pendingRecords);
+        flushedBytes += records.size();
+        newSequence = currentSequence;
+    }
+    if (!createJournal(newSequence, checkpointTime, records)) {
+        // the previous journal is kept and gets the records, they are only synced again once a rotation succeeds
+        std::lock_guard<std::mutex> pendingLock(pendingRecordsMutex);
+        pendingRecords.insert(0, records);
+        flushedBytes -= records.size();
+        currentSequence = fileSequence;
+    }
+}
+
+/**
+ * Rewrite the journal with one record per name
+ *
+ * The processes started before the checkpoint the journal follows keep their records, a replay matches them with
+ * the state of the checkpoint
+ * The new journal keeps the sequence number, it holds the same uptimes
+ */
+void compactJournal () {
+    std::lock_guard<std::mutex> lock(journalFileMutex);
+    JournalHeader header{};
+    std::map<std::string, int64_t, std::less<>> totals;
+    std::vector<EarlierRecord> earlier;
+    if (!readJournal(header, totals, earlier) || header.sequence != fileSequence)
+        return;
+    std::string records;
+    for (auto& record : earlier)
+        appendRecord(records, record.name, record.uptime, record.startTime);
+    for (auto& total : totals)
+        appendRecord(records, total.first, total.second, header.checkpointTime);
+    createJournal(header.sequence, header.checkpointTime, records);
+    compactedSize = journalSize;
+}
+
+/**
+ * Main of the journal thread
+ *
+ * Write the records in batches, at least every JOURNAL_SYNC_PERIOD, so that the tracking never waits for the disk
+ * Compact the journal when it grows too big
+ */
+void journalThread () {
+    mask_sig();
+    std::unique_lock<std::mutex> lock(pendingRecordsMutex);
+    while (!journalStopping) {
+        journalWake.wait_for(lock, std::chrono::milliseconds((long) (JOURNAL_SYNC_PERIOD * 1000)),
+                             [] { return journalStopping || publishedBytes >= flushedBytes + JOURNAL_BATCH_SIZE; });
+        lock.unlock();
+        flushJournal();
+        bool tooBig;
+        {
+            std::lock_guard<std::mutex> fileLock(journalFileMutex);
+            // a journal with many names stays big once compacted, it waits to have doubled
+            tooBig = journalSize >= JOURNAL_COMPACTION_SIZE && journalSize >= 2 * compactedSize;
+        }
+        if (tooBig)
+            compactJournal();
+        lock.lock();
+    }
+}
+
+/**
+ * Make the journal thread write what is left and return
+ */
+void stopJournal () {
+    std::lock_guard<std::mutex> lock(pendingRecordsMutex);
+    journalStopping = true;
+    journalWake.notify_one();
+}
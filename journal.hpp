@@ -0,0 +1,66 @@
+#ifndef YOTTA_JOURNAL_HPP
+#define YOTTA_JOURNAL_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Uptimes of the processes that finished since the last save or checkpoint, appended as they finish
+const char* const JOURNAL_FILE = "/var/lib/yotta/uptime.journal";
+
+/// Identifies the journal file
+const char JOURNAL_MAGIC[4] = {'Y', 'T', 'J', 'L'};
+
+/// Version of the journal format, a journal of another version is not replayed
+const uint16_t JOURNAL_VERSION = 2;
+
+/// Longest time a finished process waits before reaching the disk, in seconds
+const float JOURNAL_SYNC_PERIOD = 1;
+
+/// Records waiting to be written that wake the journal thread up before the end of the period, in bytes
+const size_t JOURNAL_BATCH_SIZE = 65536;
+
+/// Size from which the journal is rewritten with one record per name, in bytes
+const size_t JOURNAL_COMPACTION_SIZE = 4 << 20;
+
+/**
+ * Start of the journal file, followed by the records
+ *
+ * A record is a checksum on 4 bytes, the length of the name on 2 bytes, the uptime in clock ticks on 8 bytes,
+ * the start time of the process since boot in clock ticks on 8 bytes, then the name
+ * The checksum covers the rest of the record, a record cut by a crash is where the replay stops
+ */
+struct JournalHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t padding;
+    uint32_t ticksPerSecond;  ///< clock ticks per second of the host that wrote the uptimes
+    uint32_t reserved;
+    uint64_t sequence;        ///< increases each time the journal is folded into the database or a checkpoint
+    int64_t checkpointTime;   ///< time since boot of the checkpoint the journal follows, 0 if it follows a save
+};
+
+/**
+ * Record of a process that was running at the checkpoint the journal follows
+ */
+struct EarlierRecord {
+    std::string name;
+    int64_t uptime;           ///< in clock ticks of this host
+    int64_t startTime;        ///< time since boot the process started, in clock ticks
+};
+
+uint64_t replayJournal(std::vector<EarlierRecord>& ended, uint64_t stateSequence);
+void journalUptime(std::string_view name, int64_t uptime, int64_t startTime);
+uint64_t journalMark();
+void markPublished(uint64_t mark);
+uint64_t syncJournal();
+uint64_t rotateJournal();
+uint64_t rotateJournal(const std::function<uint64_t ()>& takeSnapshot);
+void cancelRotation();
+void startJournal(int64_t checkpointTime);
+void journalThread();
+void stopJournal();
+
+#endif //YOTTA_JOURNAL_HPP
@@ -0,0 +1,137 @@
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "log.h"
+#include "nameTable.hpp"
+#include "util.hpp"
+
+/// Size of the chunks the names are copied into
+const size_t ARENA_CHUNK_SIZE = 65536;
+
+/// Number of IDs per segment of the ID -> name index
+const uint32_t SEGMENT_SIZE = 4096;
+
+/// Number of segments, the table holds at most SEGMENT_SIZE * MAX_SEGMENTS names
+const uint32_t MAX_SEGMENTS = 4096;
+
+/// Serialize the interning, lookups by ID do not need it
+std::mutex internMutex;
+
+/// Name -> ID, the keys point into the arena
+std::unordered_map<std::string_view, uint32_t> ids;
+
+/// Chunks the names are stored in, they never move nor are freed so the names are stable
+std::vector<std::unique_ptr<char[]>> arena;
+size_t arenaUsed = ARENA_CHUNK_SIZE; // of the last chunk, full until there is one
+
+/// ID -> name, segments are only added so a name can be read while another is interned
+std::array<std::atomic<std::string_view*>, MAX_SEGMENTS> segments{};
+std::atomic<uint32_t> count = 0;
+
+
+/**
+ * Copy a name into the arena
+ *
+ * @param name : the name to store
+ *
+ * @return the stored name
+ */
+std::string_view storeName (std::string_view name) {
+    char* data;
+    if (name.size() > ARENA_CHUNK_SIZE / 4) {
+        // a chunk of its own, placed before the current one so that the current one stays the last
+        auto chunk = arena.insert(arena.end() - (arena.empty() ? 0 : 1), std::make_unique<char[]>(name.size()));
+        data = chunk->get();
+    } else {
+        if (arenaUsed + name.size() > ARENA_CHUNK_SIZE) {
+            arena.push_back(std::make_unique<char[]>(ARENA_CHUNK_SIZE));
+            arenaUsed = 0;
+        }
+        data = arena.back().get() + arenaUsed;
+        arenaUsed += name.size();
+    }
+    memcpy(data, name.data(), name.size());
+    return {data, name.size()};
+}
+
+/**
+ * Get the ID of a process name
+ *
+ * Each distinct name is stored only once and keeps the same ID until the daemon stops
+ * Only a new name takes memory
+ *
+ * @param name : the name of the process
+ *
+ * @return the ID of the name
+ */
+uint32_t internName (std::string_view name) {
+    std::lock_guard<std::mutex> lock(internMutex);
+    auto id = ids.find(name);
+    if (id != ids.end())
+        return id->second;
+
+    uint32_t newId = count.load(std::memory_order_relaxed);
+    if (newId == SEGMENT_SIZE * MAX_SEGMENTS)
+        error("Too many process names", FATAL);
+    if (newId % SEGMENT_SIZE == 0)
+        segments[newId / SEGMENT_SIZE].store(new std::string_view[SEGMENT_SIZE], std::memory_order_release);
+
+    std::string_view stored = storeName(name);
+    segments[newId / SEGMENT_SIZE].load(std::memory_order_relaxed)[newId % SEGMENT_SIZE] = stored;
+    ids.insert({stored, newId});
+    count.store(newId + 1, std::memory_order_release); // publish the name only once it is written
+    return newId;
+}
+
+/**
+ * Get the ID of a name that may never have been interned
+ *
+ * Unlike internName, an unknown name is not added to the table
+ *
+ * @param name : the name of the process
+ * @param id : filled with the ID of the name
+ *
+ * @return true  : if the name is in the table
+ *         false : otherwise
+ */
+bool findName (std::string_view name, uint32_t& id) {
+    std::lock_guard<std::mutex> lock(internMutex);
+    auto found = ids.find(name);
+    if (found == ids.end())
+        return false;
+    id = found->second;
+    return true;
+}
+
+/**
+ * Get the name corresponding to an ID
+ *
+ * Does not lock, it can be called from any thread while names are interned
+ *
+ * @param id : an ID given by internName
+ *
+ * @return the name, it stays valid until the daemon stops
+ */
+std::string_view nameOf (uint32_t id) {
+    if (id >= count.load(std::memory_order_acquire))
+        return {};
+    return segments[id / SEGMENT_SIZE].load(std::memory_order_acquire)[id % SEGMENT_SIZE];
+}
+
+/**
+ * Number of names interned
+ *
+ * IDs go from 0 to nameCount() - 1
+ *
+ * @return the number of names
+ */
+uint32_t nameCount () {
+    return count.load(std::memory_order_acquire);
+}
@@ -0,0 +1,30 @@
+#ifndef YOTTA_NAMETABLE_HPP
+#define YOTTA_NAMETABLE_HPP
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+uint32_t internName (std::string_view name);
+bool findName (std::string_view name, uint32_t& id);
+std::string_view nameOf (uint32_t id);
+uint32_t nameCount ();
+
+/**
+ * Entry of a buffer indexed by name ID
+ *
+ * The buffer grows to hold the entry, new entries are value-initialized
+ *
+ * @param buffer : the buffer
+ * @param nameId : the ID of the name
+ *
+ * @return the entry
+ */
+template <typename T>
+T& nameEntry (std::vector<T>& buffer, uint32_t nameId) {
+    if (nameId >= buffer.size())
+        buffer.resize(nameId + 1);
+    return buffer[nameId];
+}
+
+#endif //YOTTA_NAMETABLE_HPP
@@ -0,0 +1,297 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "config.hpp"
+#include "log.h"
+#include "nameTable.hpp"
+#include "processDiff.hpp"
+#include "procfs.hpp"
+#include "snapshot.hpp"
+#include "timeTracking.hpp"
+#include "timebase.hpp"
+#include "util.hpp"
+
+/// Size of the receive buffer of the connector socket, a bigger buffer makes fork storms less likely to overrun it
+const int CONNECTOR_RCVBUF = 4 * 1024 * 1024;
+
+/// Time to wait for the kernel to acknowledge the subscription, in milliseconds
+const int CONNECTOR_ACK_TIMEOUT = 1000;
+
+/// Longest time between an event and the publication of the snapshot that includes it, in milliseconds
+const int PUBLICATION_DELAY = 100;
+
+
+/**
+ * Convert the timestamp of a proc event to the time since boot at which it happened
+ *
+ * Events are stamped with the monotonic clock, which does not count the time the system was suspended
+ * whereas the time since boot does
+ *
+ * @param timestamp : timestamp of the event, in nanoseconds
+ *
+ * @return time since boot when the event happened, in clock ticks
+ */
+int64_t eventTicks(__u64 timestamp) {
+    struct timespec boottime{}, monotonic{};
+    clock_gettime(CLOCK_BOOTTIME, &boottime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    int64_t suspended = (boottime.tv_sec - monotonic.tv_sec) * 1000000000 + (boottime.tv_nsec - monotonic.tv_nsec);
+    return nanosecondsToTicks((int64_t) timestamp + suspended);
+}
+
+/**
+ * Send a multicast operation to the proc connector
+ *
+ * @param connector : the connector socket
+ * @param op : PROC_CN_MCAST_LISTEN or PROC_CN_MCAST_IGNORE
+ *
+ * @return true  : if the message was sent
+ *         false : otherwise
+ */
+bool sendMcastOp(int connector, enum proc_cn_mcast_op op) {
+    alignas(struct nlmsghdr) char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))]{};
+
+    auto* header = (struct nlmsghdr*) buf;
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+    header->nlmsg_type = NLMSG_DONE;
+    header->nlmsg_pid = 0;
+
+    auto* message = (struct cn_msg*) NLMSG_DATA(header);
+    message->id.idx = CN_IDX_PROC;
+    message->id.val = CN_VAL_PROC;
+    message->len = sizeof(op);
+    memcpy(message->data, &op, sizeof(op));
+
+    return send(connector, buf, header->nlmsg_len, 0) == header->nlmsg_len;
+}
+
+/**
+ * Wait for the kernel to acknowledge the subscription
+ *
+ * The kernel stays silent if the daemon is not allowed to listen (e.g. in a container) so the wait is bounded
+ *
+ * @param connector : the connector socket
+ *
+ * @return true  : if the subscription was accepted
+ *         false : otherwise
+ */
+bool waitMcastAck(int connector) {
+    alignas(struct nlmsghdr) char buf[4096];
+    struct pollfd pfd{connector, POLLIN, 0};
+    struct timespec start{}, now{};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (true) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= CONNECTOR_ACK_TIMEOUT || poll(&pfd, 1, CONNECTOR_ACK_TIMEOUT - elapsed) <= 0)
+            return false;
+
+        int len = recv(connector, buf, sizeof(buf), 0);
+        if (len < 0)
+            return false;
+        for (auto* header = (struct nlmsghdr*) buf; NLMSG_OK(header, len); header = NLMSG_NEXT(header, len)) {
+            auto* message = (struct cn_msg*) NLMSG_DATA(header);
+            auto* event = (struct proc_event*) message->data;
+            // events of other processes may come before the acknowledgement, they are covered by the first scan
+            if (event->what == proc_event::PROC_EVENT_NONE)
+                return event->event_data.ack.err == 0;
+        }
+    }
+}
+
+/**
+ * Subscribe to the process events of the kernel
+ *
+ * Needs CAP_NET_ADMIN and to run in the initial user and PID namespaces
+ *
+ * @return the connector socket, -1 if the proc connector is not available
+ */
+int openProcConnector () {
+    int connector = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (connector < 0) {
+        error("Creating the proc connector socket", INFO);
+        return -1;
+    }
+
+    struct sockaddr_nl addr{};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0; // let the kernel choose
+    if (bind(connector, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        error("Binding the proc connector socket", INFO);
+        close(connector);
+        return -1;
+    }
+
+    int rcvbuf = CONNECTOR_RCVBUF;
+    if (setsockopt(connector, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+        setsockopt(connector, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    if (!sendMcastOp(connector, PROC_CN_MCAST_LISTEN) || !waitMcastAck(connector)) {
+        error("Subscribing to the proc connector", INFO);
+        close(connector);
+        return -1;
+    }
+    return connector;
+}
+
+/**
+ * Unsubscribe from the process events and close the connector
+ *
+ * The kernel only stops building the events when no one listens anymore
+ *
+ * @param connector : the connector socket, from openProcConnector
+ */
+void closeProcConnector (int connector) {
+    sendMcastOp(connector, PROC_CN_MCAST_IGNORE);
+    close(connector);
+}
+
+/**
+ * Add a process to the process buffer
+ *
+ * If the PID is already in the buffer with another start time, it was reused and the exit of the old process was lost
+ * A process that exited before /proc could be read is built from the event: it started with it, under the name of
+ * its parent, and its exit event closes it
+ *
+ * @param processBuffer : buffer of still active processes
+ * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
+ * @param parallelTracking : buffer of start/end time of each processes
+ * @param pid : PID of the new process
+ * @param parent : PID of its parent for a fork, 0 for an exec
+ * @param now : time since boot of the event, in clock ticks
+ */
+void addProcess(ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+                std::vector<IntervalUnion>& parallelTracking, int pid, int parent, int64_t now) {
+    char buf[PROC_STAT_SIZE];
+    ProcStat stat{};
+    size_t process = processBuffer.find(pid);
+    if (!readProcStat(pid, buf, stat)) {
+        // an exec of a known process keeps it as it is, a process unknown to the buffer has nothing to be named after
+        size_t parentProcess = parent > 0 ? processBuffer.find(parent) : ProcessTable::npos;
+        if (parentProcess == ProcessTable::npos)
+            return;
+        uint32_t nameId = processBuffer.nameIds[parentProcess];
+        if (process != ProcessTable::npos)
+            endProcess(processBuffer, uptimeBuffer, parallelTracking, pid, now);
+        processBuffer.insert(pid, nameId, now);
+        return;
+    }
+
+    if (process != ProcessTable::npos) {
+        if (processBuffer.startTimes[process] == stat.startTime) {
+            processBuffer.nameIds[process] = internName(stat.name); // exec changed its name
+            return;
+        }
+        endProcess(processBuffer, uptimeBuffer, parallelTracking, pid, now);
+    }
+    processBuffer.insert(pid, internName(stat.name), stat.startTime);
+}
+
+/**
+ * Track the processes from the events sent by the kernel
+ *
+ * Fork and exec add processes to the process buffer, comm renames them and exit counts their uptime
+ * Threads are ignored, only thread group leaders are processes
+ * A snapshot is published once the events stop coming, and at least every PUBLICATION_DELAY while they keep coming
+ * Return when SIGTERM is received
+ *
+ * @param connector : the connector socket, from openProcConnector
+ * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
+ * @param processBuffer : buffer of still active processes
+ * @param gSignalStatus : signal received by the program
+ * @param parallelTracking : buffer of start/end time of each processes
+ */
+void procConnectorTracking(int connector, std::vector<int64_t>& uptimeBuffer,
+                           ProcessTable& processBuffer, volatile sig_atomic_t& gSignalStatus,
+                           std::vector<IntervalUnion>& parallelTracking) {
+    alignas(struct nlmsghdr) char buf[16384];
+    struct pollfd pfd{connector, POLLIN, 0};
+    int64_t lastCompaction = 0;
+    int64_t lastPublication = 0;
+    bool changed = false;
+
+    while (gSignalStatus != SIGTERM) {
+        // wake up every second to check the signals, sooner when changes are waiting to be published
+        if (poll(&pfd, 1, changed ? PUBLICATION_DELAY : 1000) <= 0) {
+            if (changed) {
+                publishSnapshot(processBuffer, uptimeBuffer, parallelTracking);
+                lastPublication = bootTicks();
+                changed = false;
+            }
+            continue;
+        }
+
+        int len = recv(connector, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == ENOBUFS) {
+                error("Proc connector overrun, resynchronising with /proc", WARN);
+                resyncProcessBuffer(processBuffer, uptimeBuffer, parallelTracking, bootTicks());
+                changed = true;
+            }
+            continue;
+        }
+
+        for (auto* header = (struct nlmsghdr*) buf; NLMSG_OK(header, len); header = NLMSG_NEXT(header, len)) {
+            if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP)
+                continue;
+            auto* message = (struct cn_msg*) NLMSG_DATA(header);
+            if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC)
+                continue;
+            auto* event = (struct proc_event*) message->data;
+
+            switch (event->what) {
+                case proc_event::PROC_EVENT_FORK:
+                    if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid)
+                        addProcess(processBuffer, uptimeBuffer, parallelTracking, event->event_data.fork.child_tgid,
+                                   event->event_data.fork.parent_tgid, eventTicks(event->timestamp_ns));
+                    break;
+                case proc_event::PROC_EVENT_EXEC:
+                    addProcess(processBuffer, uptimeBuffer, parallelTracking, event->event_data.exec.process_tgid,
+                               0, eventTicks(event->timestamp_ns));
+                    break;
+                case proc_event::PROC_EVENT_COMM:
+                    if (event->event_data.comm.process_pid == event->event_data.comm.process_tgid) {
+                        size_t process = processBuffer.find(event->event_data.comm.process_tgid);
+                        if (process != ProcessTable::npos)
+                            processBuffer.nameIds[process] = internName(std::string_view(
+                                    event->event_data.comm.comm, strnlen(event->event_data.comm.comm, sizeof(event->event_data.comm.comm))));
+                    }
+                    break;
+                case proc_event::PROC_EVENT_EXIT:
+                    if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+                        int64_t now = eventTicks(event->timestamp_ns);
+                        endProcess(processBuffer, uptimeBuffer, parallelTracking, event->event_data.exit.process_tgid, now);
+                        if (!config::track_parallel_processes && now - lastCompaction >= COMPACTION_PERIOD * ticksPerSecond()) {
+                            compactParallelTracking(processBuffer, parallelTracking, now);
+                            lastCompaction = now;
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        changed = true;
+
+        // the poll never times out during a storm of events
+        if (bootTicks() - lastPublication >= PUBLICATION_DELAY * ticksPerSecond() / 1000) {
+            publishSnapshot(processBuffer, uptimeBuffer, parallelTracking);
+            lastPublication = bootTicks();
+            changed = false;
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef YOTTA_PROCCONNECTOR_HPP
+#define YOTTA_PROCCONNECTOR_HPP
+
+#include <csignal>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "intervalUnion.hpp"
+#include "processTable.hpp"
+
+int openProcConnector ();
+void closeProcConnector (int connector);
+void procConnectorTracking(int connector, std::vector<int64_t>& uptimeBuffer,
+                           ProcessTable& processBuffer, volatile sig_atomic_t& gSignalStatus,
+                           std::vector<IntervalUnion>& parallelTracking);
+
+#endif //YOTTA_PROCCONNECTOR_HPP
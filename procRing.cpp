@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "procRing.hpp"
+#include "procfs.hpp"
+
+/// Kind of each request of a process, stored in the low bits of its user data
+enum RingRequest : uint64_t {
+    OPEN_STAT = 0,
+    READ_STAT = 1,
+    CLOSE_STAT = 2,
+};
+
+
+/**
+ * Set up the ring and the slots the files are opened in
+ *
+ * The ring is left unusable if the kernel does not provide io_uring, forbids it, or can not open files in the slots
+ */
+ProcRing::ProcRing() {
+    struct io_uring_params params{};
+    fd = syscall(__NR_io_uring_setup, 3 * PROC_RING_BATCH, &params);
+    if (fd < 0)
+        return;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        release();
+        return;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            release();
+            return;
+        }
+    }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*) mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        sqes = nullptr;
+        release();
+        return;
+    }
+
+    sqTail = (unsigned*) ((char*) sqRing + params.sq_off.tail);
+    sqMask = *(unsigned*) ((char*) sqRing + params.sq_off.ring_mask);
+    sqArray = (unsigned*) ((char*) sqRing + params.sq_off.array);
+    cqHead = (unsigned*) ((char*) cqRing + params.cq_off.head);
+    cqTail = (unsigned*) ((char*) cqRing + params.cq_off.tail);
+    cqMask = *(unsigned*) ((char*) cqRing + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*) ((char*) cqRing + params.cq_off.cqes);
+
+    // one empty slot per process of a batch
+    int slots[PROC_RING_BATCH];
+    std::fill(slots, slots + PROC_RING_BATCH, -1);
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, slots, PROC_RING_BATCH) < 0 || !probe())
+        release();
+}
+
+/**
+ * Submit a single request and wait for it
+ *
+ * @param request : the request
+ *
+ * @return its result, or the negated error number of the submission
+ */
+int ProcRing::run(const io_uring_sqe& request) {
+    unsigned tail = *sqTail;
+    sqes[0] = request;
+    sqArray[tail & sqMask] = 0;
+    std::atomic_ref<unsigned>(*sqTail).store(tail + 1, std::memory_order_release);
+
+    long submitted;
+    do {
+        submitted = syscall(__NR_io_uring_enter, fd, 1, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted < 0)
+        return -errno;
+
+    unsigned head = *cqHead;
+    while (head == std::atomic_ref<unsigned>(*cqTail).load(std::memory_order_acquire)) {
+        if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+            return -errno;
+    }
+    int result = cqes[head & cqMask].res;
+    std::atomic_ref<unsigned>(*cqHead).store(head + 1, std::memory_order_release);
+    return result;
+}
+
+/**
+ * Check that the kernel runs the requests of a batch as they are meant
+ *
+ * The opcodes have to be supported, and an openat has to open the file in its slot: before Linux 5.15 the slot is
+ * ignored and a real descriptor is returned, which a close of the slot would not close, or the request is rejected
+ *
+ * @return true  : if the ring can read the batches
+ *         false : otherwise
+ */
+bool ProcRing::probe() {
+    std::vector<char> buf(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+    auto* supported = (io_uring_probe*) buf.data();
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, supported, IORING_OP_LAST) < 0)
+        return false;
+    for (unsigned op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE}) {
+        if (op > supported->last_op || !(supported->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    }
+
+    io_uring_sqe request{};
+    request.opcode = IORING_OP_OPENAT;
+    request.fd = AT_FDCWD;
+    request.addr = (uint64_t) "/proc/self/stat";
+    request.open_flags = O_RDONLY;
+    request.file_index = 1;
+    int opened = run(request);
+    if (opened > 0)
+        close(opened); // the slot was ignored
+    if (opened != 0)
+        return false;
+
+    request = io_uring_sqe{};
+    request.opcode = IORING_OP_CLOSE;
+    request.file_index = 1;
+    return run(request) == 0;
+}
+
+ProcRing::~ProcRing() {
+    release();
+}
+
+/**
+ * Whether the ring can be used
+ *
+ * @return true  : if the ring was set up
+ *         false : if the files have to be read without it
+ */
+bool ProcRing::ready() const {
+    return fd >= 0;
+}
+
+/**
+ * Unmap the ring and close it, it can not be used anymore
+ */
+void ProcRing::release() {
+    if (sqes)
+        munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing)
+        munmap(sqRing, sqRingSize);
+    if (fd >= 0)
+        close(fd);
+    sqes = nullptr;
+    sqRing = cqRing = nullptr;
+    fd = -1;
+}
+
+/**
+ * Read the /proc/PID/stat file of a batch of processes
+ *
+ * Submit the openat, read and close of every process at once, then wait for all of them to complete
+ * If the submission fails, the requests already submitted are still waited for, as they write into the buffers,
+ * then the ring is released and the files have to be read without it
+ *
+ * @param pids : PIDs of the processes
+ * @param count : number of processes, at most PROC_RING_BATCH
+ * @param buffers : count buffers of PROC_STAT_SIZE bytes, one after the other, each file is read into its own
+ * @param results : filled with the number of bytes read for each process, or the negated error number
+ *
+ * @return true  : if all the requests completed
+ *         false : if the ring is not usable
+ */
+bool ProcRing::readStats(const int* pids, size_t count, char* buffers, int* results) {
+    if (fd < 0)
+        return false;
+
+    unsigned tail = *sqTail;
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(paths[i], sizeof(paths[i]), "/proc/%d/stat", pids[i]);
+        results[i] = 0;
+
+        // the read only runs if the file was opened, the close even if the read failed
+        io_uring_sqe* sqe = &sqes[3 * i];
+        memset(sqe, 0, 3 * sizeof(io_uring_sqe));
+        sqe[0].opcode = IORING_OP_OPENAT;
+        sqe[0].flags = IOSQE_IO_LINK;
+        sqe[0].fd = AT_FDCWD;
+        sqe[0].addr = (uint64_t) paths[i];
+        sqe[0].open_flags = O_RDONLY;
+        sqe[0].file_index = i + 1;
+        sqe[0].user_data = (i << 2) | OPEN_STAT;
+
+        sqe[1].opcode = IORING_OP_READ;
+        sqe[1].flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        sqe[1].fd = i;
+        sqe[1].addr = (uint64_t) (buffers + i * PROC_STAT_SIZE);
+        sqe[1].len = PROC_STAT_SIZE;
+        sqe[1].user_data = (i << 2) | READ_STAT;
+
+        sqe[2].opcode = IORING_OP_CLOSE;
+        sqe[2].file_index = i + 1;
+        sqe[2].user_data = (i << 2) | CLOSE_STAT;
+
+        for (unsigned j = 0; j < 3; ++j)
+            sqArray[(tail + j) & sqMask] = 3 * i + j;
+        tail += 3;
+    }
+    std::atomic_ref<unsigned>(*sqTail).store(tail, std::memory_order_release);
+
+    unsigned total = 3 * count;
+    unsigned toSubmit = total;
+    unsigned completed = 0;
+    bool failed = false;
+    while (completed < total) {
+        long submitted = syscall(__NR_io_uring_enter, fd, toSubmit, total - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // the requests left in the queue are never submitted, only those in flight are waited for
+            if (failed || toSubmit == 0)
+                break;
+            failed = true;
+            total -= toSubmit;
+            toSubmit = 0;
+        }
+        if (submitted > 0)
+            toSubmit -= submitted;
+
+        unsigned head = *cqHead;
+        unsigned available = std::atomic_ref<unsigned>(*cqTail).load(std::memory_order_acquire);
+        for (; head != available; ++head, ++completed) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            size_t i = cqe.user_data >> 2;
+            RingRequest request = (RingRequest) (cqe.user_data & 3);
+            // a read cancelled because the openat failed keeps the error of the openat
+            if ((request == OPEN_STAT && cqe.res < 0) || (request == READ_STAT && results[i] == 0))
+                results[i] = cqe.res;
+        }
+        std::atomic_ref<unsigned>(*cqHead).store(head, std::memory_order_release);
+    }
+    if (failed || completed < total) {
+        release();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef YOTTA_PROCRING_HPP
+#define YOTTA_PROCRING_HPP
+
+#include <cstddef>
+
+#include <linux/io_uring.h>
+
+/// Most /proc/PID/stat files read with one submission, each one takes an openat, a read and a close
+const size_t PROC_RING_BATCH = 64;
+
+/**
+ * io_uring instance that reads a batch of /proc/PID/stat files with a single submission
+ *
+ * The file of each process is opened in a registered slot, so that the read and the close are linked to the openat
+ * in the same submission instead of waiting for its descriptor
+ * Opening in a slot needs Linux 5.15, the ring is only used once the kernel proved it does
+ */
+struct ProcRing {
+    ProcRing();
+    ~ProcRing();
+    ProcRing(const ProcRing&) = delete;
+    ProcRing& operator= (const ProcRing&) = delete;
+
+    bool ready() const;
+    bool readStats(const int* pids, size_t count, char* buffers, int* results);
+
+private:
+    int fd = -1;
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    /// Paths of the batch in flight, the kernel reads them until their openat completes
+    char paths[PROC_RING_BATCH][32];
+
+    bool probe();
+    int run(const io_uring_sqe& request);
+    void release();
+};
+
+#endif //YOTTA_PROCRING_HPP
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "processDiff.hpp"
+#include "procfs.hpp"
+#include "util.hpp"
+
+
+/**
+ * Read the start time of a range of processes
+ *
+ * @param pids : PIDs of the running processes
+ * @param begin : first index of the range
+ * @param end : index after the last one of the range
+ * @param snapshot : the identity of each process is appended to it
+ */
+void snapshotRange(const std::vector<int>& pids, size_t begin, size_t end, std::vector<ProcessKey>& snapshot) {
+    readProcStats(pids.data() + begin, end - begin, [&](size_t, const ProcStat* stat) {
+        if (stat)
+            snapshot.push_back({stat->pid, stat->startTime});
+    });
+}
+
+/**
+ * Take a snapshot of the running processes
+ *
+ * A process listed with the same inode as in the previous snapshot keeps its start time, only the others are read
+ * A reused PID has a new inode, it is read again
+ * Those that ended in the meantime are left out
+ * On hosts with a lot of processes to read, the PIDs are split between several workers, each one with its own result
+ * The shards are contiguous so putting the results back one after the other keeps them sorted
+ *
+ * @param entries : directories of the running processes, sorted by PID
+ * @param previousEntries : directories listed for the previous snapshot, empty to read every process
+ * @param previous : the previous snapshot
+ * @param snapshot : filled with the identity of each process, sorted by PID
+ */
+void takeSnapshot(const std::vector<ProcDirEntry>& entries, const std::vector<ProcDirEntry>& previousEntries,
+                  const std::vector<ProcessKey>& previous, std::vector<ProcessKey>& snapshot) {
+    snapshot.clear();
+    snapshot.reserve(entries.size());
+
+    std::vector<int> pids;
+    auto o = previousEntries.begin();
+    auto p = previous.begin();
+    for (auto& entry : entries) {
+        while (o != previousEntries.end() && o->pid < entry.pid)
+            ++o;
+        while (p != previous.end() && p->pid < entry.pid)
+            ++p;
+        if (o != previousEntries.end() && *o == entry && p != previous.end() && p->pid == entry.pid)
+            snapshot.push_back(*p);
+        else
+            pids.push_back(entry.pid);
+    }
+    if (pids.empty())
+        return;
+
+    size_t kept = snapshot.size();
+    size_t shards = shardCount(pids.size());
+    if (shards == 1) {
+        snapshotRange(pids, 0, pids.size(), snapshot);
+    } else {
+        std::vector<std::vector<ProcessKey>> results(shards);
+        runSharded(pids.size(), shards, [&](size_t shard, size_t begin, size_t end) {
+            results[shard].reserve(end - begin);
+            snapshotRange(pids, begin, end, results[shard]);
+        });
+        for (auto& result : results)
+            snapshot.insert(snapshot.end(), result.begin(), result.end());
+    }
+    std::inplace_merge(snapshot.begin(), snapshot.begin() + kept, snapshot.end(),
+                       [](const ProcessKey& a, const ProcessKey& b) { return a.pid < b.pid; });
+}
+
+/**
+ * Find the processes that started and ended between two snapshots
+ *
+ * Walk both snapshots at once, they are sorted by PID so it is linear
+ * A PID in both snapshots with two start times has been reused, the old process ended and the new one started
+ *
+ * @param oldSnapshot : the previous snapshot
+ * @param newSnapshot : the current snapshot
+ * @param started : filled with the processes only in newSnapshot
+ * @param ended : filled with the processes only in oldSnapshot
+ */
+void diffProcesses(const std::vector<ProcessKey>& oldSnapshot, const std::vector<ProcessKey>& newSnapshot,
+                   std::vector<ProcessKey>& started, std::vector<ProcessKey>& ended) {
+    started.clear();
+    ended.clear();
+
+    auto o = oldSnapshot.begin();
+    auto n = newSnapshot.begin();
+    while (o != oldSnapshot.end() && n != newSnapshot.end()) {
+        if (o->pid < n->pid) {
+            ended.push_back(*o++);
+        } else if (n->pid < o->pid) {
+            started.push_back(*n++);
+        } else {
+            if (o->startTime != n->startTime) {
+                ended.push_back(*o);
+                started.push_back(*n);
+            }
+            ++o;
+            ++n;
+        }
+    }
+    ended.insert(ended.end(), o, oldSnapshot.end());
+    started.insert(started.end(), n, newSnapshot.end());
+}
@@ -0,0 +1,22 @@
+#ifndef YOTTA_PROCESSDIFF_HPP
+#define YOTTA_PROCESSDIFF_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "procfs.hpp"
+
+/// Identity of a process, a PID alone can be reused by another process
+struct ProcessKey {
+    int pid;
+    int64_t startTime; ///< clock ticks since boot
+
+    bool operator== (const ProcessKey&) const = default;
+};
+
+void takeSnapshot(const std::vector<ProcDirEntry>& entries, const std::vector<ProcDirEntry>& previousEntries,
+                  const std::vector<ProcessKey>& previous, std::vector<ProcessKey>& snapshot);
+void diffProcesses(const std::vector<ProcessKey>& oldSnapshot, const std::vector<ProcessKey>& newSnapshot,
+                   std::vector<ProcessKey>& started, std::vector<ProcessKey>& ended);
+
+#endif //YOTTA_PROCESSDIFF_HPP
@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "processTable.hpp"
+
+/// Capacity of a table the first time something is inserted, always a power of 2
+const size_t INITIAL_CAPACITY = 1024;
+
+
+/**
+ * Slot where a PID should be if there were no collision
+ *
+ * @param pid : the PID
+ *
+ * @return the slot
+ */
+size_t ProcessTable::home (int pid) const {
+    // PIDs are mostly consecutive, multiplying spreads them over the table
+    return ((uint32_t) pid * 2654435769u) & (capacity() - 1);
+}
+
+/**
+ * Double the capacity and put every process back in place
+ */
+void ProcessTable::grow () {
+    ProcessTable bigger;
+    size_t newCapacity = capacity() == 0 ? INITIAL_CAPACITY : capacity() * 2;
+    bigger.pids.resize(newCapacity);
+    bigger.startTimes.resize(newCapacity);
+    bigger.nameIds.resize(newCapacity);
+    bigger.states.resize(newCapacity, EMPTY);
+
+    for (size_t slot = 0; slot < capacity(); ++slot) {
+        if (states[slot] == LIVE)
+            bigger.insert(pids[slot], nameIds[slot], startTimes[slot]);
+    }
+    *this = std::move(bigger);
+}
+
+/**
+ * Find the slot of a process
+ *
+ * @param pid : PID of the process
+ *
+ * @return the slot, npos if the process is not in the table
+ */
+size_t ProcessTable::find (int pid) const {
+    if (count == 0)
+        return npos;
+    for (size_t slot = home(pid); states[slot] == LIVE; slot = (slot + 1) & (capacity() - 1)) {
+        if (pids[slot] == pid)
+            return slot;
+    }
+    return npos;
+}
+
+/**
+ * Whether a process is in the table
+ *
+ * @param pid : PID of the process
+ *
+ * @return true  : if it is
+ *         false : otherwise
+ */
+bool ProcessTable::contains (int pid) const {
+    return find(pid) != npos;
+}
+
+/**
+ * Add a process
+ *
+ * Like std::map::insert, nothing changes if the PID is already in the table
+ * The table is kept at most half full so that probing stays short
+ *
+ * @param pid : PID of the process
+ * @param nameId : ID of its name
+ * @param startTime : its start time, in clock ticks since boot
+ *
+ * @return the slot of the process
+ */
+size_t ProcessTable::insert (int pid, uint32_t nameId, int64_t startTime) {
+    if ((count + 1) * 2 > capacity())
+        grow();
+
+    size_t slot = home(pid);
+    for (; states[slot] == LIVE; slot = (slot + 1) & (capacity() - 1)) {
+        if (pids[slot] == pid)
+            return slot;
+    }
+    pids[slot] = pid;
+    startTimes[slot] = startTime;
+    nameIds[slot] = nameId;
+    states[slot] = LIVE;
+    ++count;
+    return slot;
+}
+
+/**
+ * Remove the process of a slot
+ *
+ * The following processes of the same cluster are shifted back so that no tombstone is needed
+ * Other slots may change, slots found before the call can not be used after it
+ *
+ * @param slot : slot of the process, from find
+ */
+void ProcessTable::erase (size_t slot) {
+    size_t mask = capacity() - 1;
+    states[slot] = EMPTY;
+    --count;
+
+    for (size_t next = (slot + 1) & mask; states[next] == LIVE; next = (next + 1) & mask) {
+        // a process can move back to the hole only if the hole is between its home and where it is
+        size_t wanted = home(pids[next]);
+        if (((next - wanted) & mask) >= ((next - slot) & mask)) {
+            pids[slot] = pids[next];
+            startTimes[slot] = startTimes[next];
+            nameIds[slot] = nameIds[next];
+            states[slot] = LIVE;
+            states[next] = EMPTY;
+            slot = next;
+        }
+    }
+}
+
+/**
+ * Remove every process, the capacity is kept
+ */
+void ProcessTable::clear () {
+    std::fill(states.begin(), states.end(), EMPTY);
+    count = 0;
+}
+
+/**
+ * Number of processes in the table
+ *
+ * @return the number of LIVE slots
+ */
+size_t ProcessTable::size () const {
+    return count;
+}
+
+/**
+ * Number of slots, the bound to iterate over them
+ *
+ * @return the number of slots, a power of two, 0 before the first insert
+ */
+size_t ProcessTable::capacity () const {
+    return states.size();
+}
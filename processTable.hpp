@@ -0,0 +1,39 @@
+#ifndef YOTTA_PROCESSTABLE_HPP
+#define YOTTA_PROCESSTABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Running processes, by PID
+ *
+ * Open addressing hash table with linear probing, each field in its own contiguous array
+ * A slot is used when its state is LIVE, the other fields of an unused slot mean nothing
+ */
+struct ProcessTable {
+    static constexpr uint8_t EMPTY = 0;
+    static constexpr uint8_t LIVE = 1;
+    static constexpr size_t npos = -1;
+
+    std::vector<int> pids;
+    std::vector<int64_t> startTimes;  ///< clock ticks since boot
+    std::vector<uint32_t> nameIds;
+    std::vector<uint8_t> states;
+
+    size_t find (int pid) const;
+    bool contains (int pid) const;
+    size_t insert (int pid, uint32_t nameId, int64_t startTime);
+    void erase (size_t slot);
+    void clear ();
+    size_t size () const;
+    size_t capacity () const;
+
+private:
+    size_t count = 0;
+
+    size_t home (int pid) const;
+    void grow ();
+};
+
+#endif //YOTTA_PROCESSTABLE_HPP
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+#include "config.hpp"
+#include "log.h"
+#include "procRing.hpp"
+#include "procfs.hpp"
+#include "util.hpp"
+
+/// Index of the start time in /proc/PID/stat, counted from 1
+const int START_TIME_FIELD = 22;
+
+/// Size of the buffer the entries of /proc are read into, a few hundred entries per getdents64 call
+const size_t DIRENT_BUFFER_SIZE = 32768;
+
+
+/**
+ * Parse the content of /proc/PID/stat
+ *
+ * The name is in brackets and may itself contain brackets or spaces, so it ends at the last ')'
+ * The fields after it are plain numbers or letters separated by one space, the 22th is the start time
+ *
+ * @param pid : PID of the process
+ * @param buf : content of the file
+ * @param length : length of the content
+ * @param stat : filled with the PID, the start time and the name, which points into buf
+ *
+ * @return true  : if the content is well formed
+ *         false : otherwise
+ */
+bool parseProcStat(int pid, const char* buf, size_t length, ProcStat& stat) {
+    const char* end = buf + length;
+    const char* nameStart = (const char*) memchr(buf, '(', length);
+    const char* nameEnd = (const char*) memrchr(buf, ')', length);
+    if (nameStart == nullptr || nameEnd == nullptr || nameEnd < nameStart)
+        return false;
+
+    // ") " then the 3rd field, a line truncated right after the name has none
+    if (end - nameEnd < 2)
+        return false;
+    const char* c = nameEnd + 2;
+    for (int field = 3; field != START_TIME_FIELD; ++field) {
+        c = (const char*) memchr(c, ' ', end - c);
+        if (c == nullptr)
+            return false;
+        ++c;
+    }
+
+    int64_t startTime = 0;
+    if (c >= end || *c < '0' || *c > '9')
+        return false;
+    for (; c < end && *c >= '0' && *c <= '9'; ++c)
+        startTime = startTime * 10 + (*c - '0');
+
+    stat.pid = pid;
+    stat.startTime = startTime;
+    stat.name = std::string_view(nameStart + 1, nameEnd - nameStart - 1);
+    return true;
+}
+
+/**
+ * Read /proc/PID/stat with a single read
+ *
+ * @param pid : PID of the process
+ * @param buf : buffer the file is read into, stat.name points into it
+ * @param stat : filled with the PID, the start time and the name
+ *
+ * @return true  : if the process could be read
+ *         false : if the process has certainly finished or can not be read
+ */
+bool readProcStat(int pid, char (&buf)[PROC_STAT_SIZE], ProcStat& stat) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    ssize_t length = read(fd, buf, PROC_STAT_SIZE);
+    close(fd);
+    if (length <= 0)
+        return false;
+
+    return parseProcStat(pid, buf, length, stat);
+}
+
+/**
+ * Read /proc/PID/stat of many processes
+ *
+ * With io_uring, the files are read by batches of PROC_RING_BATCH with a single submission each
+ * Each thread has its own ring, set up the first time it reads and kept until it exits: the tracking thread and
+ * the workers of the pool of runSharded live for the whole run, so a ring is only set up once per thread
+ * Without it, or for a file the ring could not read for another reason than the process having finished,
+ * the file is read synchronously
+ *
+ * @param pids : PIDs of the processes
+ * @param count : number of processes
+ * @param handle : called with the index of each process and what was read, nullptr if it could not be read
+ *                 the name only lives until handle returns
+ */
+void readProcStats(const int* pids, size_t count, const std::function<void (size_t, const ProcStat*)>& handle) {
+    thread_local std::unique_ptr<ProcRing> ring;
+    thread_local std::vector<char> buffers(PROC_RING_BATCH * PROC_STAT_SIZE);
+    char buf[PROC_STAT_SIZE];
+    int results[PROC_RING_BATCH];
+    ProcStat stat{};
+
+    if (config::io_uring && !ring) {
+        ring = std::make_unique<ProcRing>();
+        static std::atomic<bool> reported{false};
+        if (!ring->ready() && !reported.exchange(true))
+            error("io_uring is not available, /proc is read synchronously", INFO);
+    }
+
+    for (size_t batch = 0; batch < count; batch += PROC_RING_BATCH) {
+        size_t size = std::min(PROC_RING_BATCH, count - batch);
+        bool batched = config::io_uring && ring->readStats(pids + batch, size, buffers.data(), results);
+        for (size_t i = 0; i < size; ++i) {
+            int pid = pids[batch + i];
+            bool found;
+            if (batched && results[i] > 0)
+                found = parseProcStat(pid, buffers.data() + i * PROC_STAT_SIZE, results[i], stat);
+            else if (batched && (results[i] == 0 || results[i] == -ENOENT || results[i] == -ESRCH))
+                found = false; // the process has finished
+            else
+                found = readProcStat(pid, buf, stat);
+            handle(batch + i, found ? &stat : nullptr);
+        }
+    }
+}
+
+/**
+ * List the PIDs of the running processes
+ *
+ * Read the entries of /proc with getdents64, the only directories whose name is a number are processes
+ * Threads are not listed in /proc, only under /proc/PID/task
+ * The inode of each directory comes with it, a PID whose inode did not change is still the same process
+ * /proc stays open and is rewound between calls, and the entries are read into the same buffer
+ *
+ * @param entries : filled with the PID and the inode of each process, sorted by PID
+ *
+ * @return true  : if /proc could be read
+ *         false : otherwise
+ */
+bool listPids(std::vector<ProcDirEntry>& entries) {
+    static int procFd = -1;
+    static std::vector<char> buf(DIRENT_BUFFER_SIZE);
+
+    entries.clear();
+    if (procFd < 0) {
+        procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (procFd < 0)
+            return false;
+    } else if (lseek(procFd, 0, SEEK_SET) < 0) {
+        return false;
+    }
+
+    ssize_t length;
+    while ((length = getdents64(procFd, buf.data(), buf.size())) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            auto* entry = (struct dirent64*) (buf.data() + offset);
+            offset += entry->d_reclen;
+
+            if (entry->d_type != DT_DIR || entry->d_name[0] < '1' || entry->d_name[0] > '9')
+                continue;
+            int pid = 0;
+            const char* c = entry->d_name;
+            for (; *c >= '0' && *c <= '9'; ++c)
+                pid = pid * 10 + (*c - '0');
+            if (*c == '\0')
+                entries.push_back({pid, entry->d_ino});
+        }
+    }
+    if (length < 0)
+        return false;
+
+    // the kernel lists them in increasing order, but nothing promises it
+    auto byPid = [](const ProcDirEntry& a, const ProcDirEntry& b) { return a.pid < b.pid; };
+    if (!std::is_sorted(entries.begin(), entries.end(), byPid))
+        std::sort(entries.begin(), entries.end(), byPid);
+    return true;
+}
+
+/**
+ * Read a whole small file of /proc with a single read
+ *
+ * @param path : path of the file
+ * @param buf : buffer the file is read into, terminated by a null character
+ * @param size : size of the buffer
+ *
+ * @return the length read, -1 if the file could not be read
+ */
+ssize_t readProcFile(const char* path, char* buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t length = read(fd, buf, size - 1);
+    close(fd);
+    if (length >= 0)
+        buf[length] = '\0';
+    return length;
+}
+
+/**
+ * Read the task counters of the system
+ *
+ * If neither of them changed between two reads, no process started or ended in the meantime:
+ * a new task increments the fork counter and a task that is reaped decrements the number of tasks
+ *
+ * @param counters : filled with the counters
+ *
+ * @return true  : if the counters could be read
+ *         false : otherwise
+ */
+bool readTaskCounters(TaskCounters& counters) {
+    // /proc/stat has one line per CPU and one number per interrupt before the counter
+    static std::vector<char> buf(65536);
+
+    ssize_t length = readProcFile("/proc/stat", buf.data(), buf.size());
+    if (length < 0)
+        return false;
+    const char* forks = strstr(buf.data(), "\nprocesses ");
+    if (forks == nullptr)
+        return false;
+    counters.forks = strtoull(forks + 11, nullptr, 10);
+
+    // "0.00 0.01 0.05 1/123 4567", 123 is the number of tasks
+    if (readProcFile("/proc/loadavg", buf.data(), buf.size()) < 0)
+        return false;
+    const char* threads = strchr(buf.data(), '/');
+    if (threads == nullptr)
+        return false;
+    counters.threads = strtoul(threads + 1, nullptr, 10);
+    return true;
+}
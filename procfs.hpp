@@ -0,0 +1,43 @@
+#ifndef YOTTA_PROCFS_HPP
+#define YOTTA_PROCFS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+/// Size of the buffer /proc/PID/stat is read into, the name takes at most 64 characters and the 50 numeric fields
+/// at most 20 digits each
+const size_t PROC_STAT_SIZE = 1200;
+
+/// What yotta needs from /proc/PID/stat
+struct ProcStat {
+    int pid;
+    int64_t startTime;      ///< clock ticks since boot
+    std::string_view name;  ///< points into the buffer the file was read into
+};
+
+/// Directory of a process in /proc, it gets another inode when its PID is reused by another process
+struct ProcDirEntry {
+    int pid;
+    uint64_t inode;
+
+    bool operator== (const ProcDirEntry&) const = default;
+};
+
+/// Counters that change whenever a task is created or reaped
+struct TaskCounters {
+    unsigned long long forks;  ///< tasks created since boot, 'processes' in /proc/stat
+    unsigned long threads;     ///< tasks currently existing, in /proc/loadavg
+
+    bool operator== (const TaskCounters&) const = default;
+};
+
+bool parseProcStat(int pid, const char* buf, size_t length, ProcStat& stat);
+bool readProcStat(int pid, char (&buf)[PROC_STAT_SIZE], ProcStat& stat);
+void readProcStats(const int* pids, size_t count, const std::function<void (size_t, const ProcStat*)>& handle);
+bool listPids(std::vector<ProcDirEntry>& entries);
+bool readTaskCounters(TaskCounters& counters);
+
+#endif //YOTTA_PROCFS_HPP
@@ -0,0 +1,146 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "protocol.hpp"
+
+
+/**
+ * Build the header of a frame of the current version
+ *
+ * @param type : type of the frame
+ * @param count : number of records of the payload, or what the type gives it for meaning
+ * @param length : length of the payload, in bytes
+ *
+ * @return the header
+ */
+FrameHeader makeFrameHeader(FrameType type, uint32_t count, uint32_t length) {
+    FrameHeader header{};
+    memcpy(header.magic, PROTOCOL_MAGIC, sizeof(header.magic));
+    header.version = PROTOCOL_VERSION;
+    header.type = type;
+    header.count = count;
+    header.length = length;
+    return header;
+}
+
+/**
+ * Check that a header is one of the binary protocol, whatever its version
+ *
+ * @param header : the header
+ *
+ * @return true  : if it starts with PROTOCOL_MAGIC
+ *         false : otherwise
+ */
+bool isFrameHeader(const FrameHeader& header) {
+    return memcmp(header.magic, PROTOCOL_MAGIC, sizeof(header.magic)) == 0;
+}
+
+/**
+ * Append a name to a payload
+ *
+ * The length of the name on 2 bytes, then the name
+ *
+ * @param payload : the payload
+ * @param name : the name
+ */
+void appendName(std::string& payload, std::string_view name) {
+    uint16_t length = name.size();
+    payload.append((const char*) &length, sizeof(length));
+    payload.append(name.data(), length);
+}
+
+/**
+ * Read the next name of a payload
+ *
+ * @param cursor : where the name starts, moved after it
+ * @param end : end of the payload
+ * @param name : filled with the name, which points into the payload
+ *
+ * @return true  : if a whole name was read
+ *         false : if the payload is truncated
+ */
+bool readName(const char*& cursor, const char* end, std::string_view& name) {
+    uint16_t length;
+    if (end - cursor < (long) sizeof(length))
+        return false;
+    memcpy(&length, cursor, sizeof(length));
+    cursor += sizeof(length);
+    if (end - cursor < length)
+        return false;
+    name = std::string_view(cursor, length);
+    cursor += length;
+    return true;
+}
+
+/**
+ * Append the record of a name to the payload of an UPTIMES_RESPONSE
+ *
+ * A record is the uptime on 8 bytes, then the name
+ *
+ * @param payload : the payload
+ * @param name : the name
+ * @param uptime : its uptime, in clock ticks
+ */
+void appendUptimeRecord(std::string& payload, std::string_view name, int64_t uptime) {
+    payload.append((const char*) &uptime, sizeof(uptime));
+    appendName(payload, name);
+}
+
+/**
+ * Read the next record of the payload of an UPTIMES_RESPONSE
+ *
+ * @param cursor : where the record starts, moved after it
+ * @param end : end of the payload
+ * @param name : filled with the name, which points into the payload
+ * @param uptime : filled with its uptime, in clock ticks
+ *
+ * @return true  : if a whole record was read
+ *         false : if the payload is truncated
+ */
+bool readUptimeRecord(const char*& cursor, const char* end, std::string_view& name, int64_t& uptime) {
+    if (end - cursor < (long) sizeof(uptime))
+        return false;
+    memcpy(&uptime, cursor, sizeof(uptime));
+    cursor += sizeof(uptime);
+    return readName(cursor, end, name);
+}
+
+/**
+ * Append the record of a name to the payload of an UPTIMES_DELTA
+ *
+ * A record is the uptime on 8 bytes, the rate on 4 bytes, then the name
+ * Until the next record of the name, its uptime is uptime + rate * (now - time of the delta)
+ *
+ * @param payload : the payload
+ * @param name : the name
+ * @param uptime : its uptime at the time of the delta, in clock ticks
+ * @param rate : clock ticks it gains per clock tick
+ */
+void appendDeltaRecord(std::string& payload, std::string_view name, int64_t uptime, uint32_t rate) {
+    payload.append((const char*) &uptime, sizeof(uptime));
+    payload.append((const char*) &rate, sizeof(rate));
+    appendName(payload, name);
+}
+
+/**
+ * Read the next record of the payload of an UPTIMES_DELTA
+ *
+ * @param cursor : where the record starts, moved after it
+ * @param end : end of the payload
+ * @param name : filled with the name, which points into the payload
+ * @param uptime : filled with its uptime at the time of the delta, in clock ticks
+ * @param rate : filled with the clock ticks it gains per clock tick
+ *
+ * @return true  : if a whole record was read
+ *         false : if the payload is truncated
+ */
+bool readDeltaRecord(const char*& cursor, const char* end, std::string_view& name, int64_t& uptime, uint32_t& rate) {
+    if (end - cursor < (long) (sizeof(uptime) + sizeof(rate)))
+        return false;
+    memcpy(&uptime, cursor, sizeof(uptime));
+    memcpy(&rate, cursor + sizeof(uptime), sizeof(rate));
+    cursor += sizeof(uptime) + sizeof(rate);
+    return readName(cursor, end, name);
+}
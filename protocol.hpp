@@ -0,0 +1,76 @@
+#ifndef YOTTA_PROTOCOL_HPP
+#define YOTTA_PROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/// Start of every frame of the binary protocol, no text request starts with it
+const char PROTOCOL_MAGIC[4] = {'Y', 'T', 'T', 'A'};
+
+/// Version of the binary protocol, a daemon only answers the version it speaks
+const uint16_t PROTOCOL_VERSION = 4;
+
+/// Biggest payload of a request, in bytes
+const uint32_t MAX_REQUEST_PAYLOAD = 65536;
+
+/// What a frame carries
+enum FrameType : uint16_t {
+    UPTIMES_REQUEST = 1,   ///< an UptimeQuery then the names it asks for, count is the number of names
+    UPTIMES_RESPONSE = 2,  ///< one record per name
+    ERROR_RESPONSE = 3,    ///< the request was not understood, the version is the one of the daemon
+    SUBSCRIBE_REQUEST = 4, ///< same payload as UPTIMES_REQUEST, only the names are used
+    UPTIMES_DELTA = 5,     ///< the time of the uptimes on 8 bytes, then one delta record per name that changed
+    ADMIN_REQUEST = 6,     ///< no payload, count is an AdminCommand, only root may send it
+    ADMIN_RESPONSE = 7,    ///< count is an AdminStatus, the payload is text to display
+};
+
+/// What an ADMIN_REQUEST asks the daemon to do
+enum AdminCommand : uint32_t {
+    SAVE_COMMAND = 1,        ///< write a checkpoint and answer once it is written
+    RELOAD_COMMAND = 2,      ///< reload the config file
+    CHECKPOINT_COMMAND = 3,  ///< write a checkpoint, without waiting for it
+    SHUTDOWN_COMMAND = 4,    ///< stop as when the service is stopped
+    STATS_COMMAND = 5,       ///< describe the state of the daemon, one "name: value" line each
+};
+
+/// Outcome of an ADMIN_REQUEST
+enum AdminStatus : uint32_t {
+    ADMIN_DONE = 0,
+    ADMIN_DENIED = 1,   ///< the client is not root
+    ADMIN_FAILED = 2,   ///< the command was run but did not succeed
+    ADMIN_UNKNOWN = 3,  ///< the daemon does not know the command
+};
+
+/**
+ * Header of every frame, followed by its payload
+ *
+ * Client and daemon run on the same host, numbers are in its byte order
+ */
+struct FrameHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t type;
+    uint32_t count;   ///< number of records in the payload
+    uint32_t length;  ///< size of the payload, in bytes
+};
+
+/// Which uptimes an UPTIMES_REQUEST asks for, 0 means no condition
+struct UptimeQuery {
+    int64_t minUptime;  ///< only uptimes greater than it, in clock ticks
+    int64_t maxUptime;  ///< only uptimes lower than it, in clock ticks
+    uint32_t limit;     ///< at most that many names, those with the greatest uptimes
+    uint32_t padding;
+};
+
+FrameHeader makeFrameHeader(FrameType type, uint32_t count, uint32_t length);
+bool isFrameHeader(const FrameHeader& header);
+void appendName(std::string& payload, std::string_view name);
+bool readName(const char*& cursor, const char* end, std::string_view& name);
+void appendUptimeRecord(std::string& payload, std::string_view name, int64_t uptime);
+bool readUptimeRecord(const char*& cursor, const char* end, std::string_view& name, int64_t& uptime);
+void appendDeltaRecord(std::string& payload, std::string_view name, int64_t uptime, uint32_t rate);
+bool readDeltaRecord(const char*& cursor, const char* end, std::string_view& name, int64_t& uptime, uint32_t& rate);
+
+#endif //YOTTA_PROTOCOL_HPP
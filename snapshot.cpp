@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/eventfd.h>
+
+#include "config.hpp"
+#include "journal.hpp"
+#include "nameTable.hpp"
+#include "snapshot.hpp"
+#include "timebase.hpp"
+
+/// Last snapshot published by the tracking thread
+std::atomic<std::shared_ptr<const TrackingSnapshot>> published{std::make_shared<const TrackingSnapshot>()};
+
+
+/**
+ * Publish a copy of the buffers of the tracking thread
+ *
+ * Only the tracking thread publishes, readers keep the snapshot they took alive until they release it
+ * The snapshot counts all the journal records appended so far, the journal only writes them once it is published
+ *
+ * @param processBuffer : buffer of still active processes
+ * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
+ * @param parallelTracking : buffer of start/end time of each processes
+ */
+void publishSnapshot(const ProcessTable& processBuffer, const std::vector<int64_t>& uptimeBuffer,
+                     const std::vector<IntervalUnion>& parallelTracking) {
+    uint64_t generation = published.load(std::memory_order_relaxed)->generation + 1;
+    uint64_t mark = journalMark();
+    published.store(std::make_shared<const TrackingSnapshot>(
+            TrackingSnapshot{generation, bootTicks(), processBuffer, uptimeBuffer, parallelTracking, mark}),
+            std::memory_order_release);
+    markPublished(mark);
+
+    uint64_t one = 1;
+    write(publicationFd(), &one, sizeof(one));
+}
+
+/**
+ * Take the last published snapshot, without waiting for the tracking thread
+ *
+ * @return the snapshot, empty until the first publication
+ */
+std::shared_ptr<const TrackingSnapshot> currentSnapshot() {
+    return published.load(std::memory_order_acquire);
+}
+
+/**
+ * Event file that becomes readable after each publication
+ *
+ * Readers that follow the publications wait on it and read it before taking the snapshot
+ *
+ * @return the event file
+ */
+int publicationFd() {
+    static const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return fd;
+}
+
+/**
+ * Uptime of each name, as if all the processes of the snapshot had just been closed
+ *
+ * The snapshot is left as it is, only the intervals of the names that are running are copied
+ * The running processes are counted exactly up to now, the uptimes grow at the rate given by uptimeRates
+ *
+ * @param snapshot : the snapshot
+ * @param now : actual time since boot, in clock ticks
+ *
+ * @return the uptimes, indexed by name ID, in clock ticks
+ */
+std::vector<int64_t> projectUptimes(const TrackingSnapshot& snapshot, int64_t now) {
+    const ProcessTable& processBuffer = snapshot.processBuffer;
+    std::vector<int64_t> uptimeBuffer = snapshot.uptimeBuffer;
+    std::map<uint32_t, IntervalUnion> parallelTracking;
+    uint32_t nameId;
+    int64_t processUptime;
+
+    for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+        if (processBuffer.states[slot] != ProcessTable::LIVE)
+            continue;
+        nameId = processBuffer.nameIds[slot];
+        int64_t processStartTime = processBuffer.startTimes[slot];
+
+        if (config::track_parallel_processes) {
+            processUptime = now - processStartTime;
+        } else {
+            //if i don't want to track parallel running processes, only the time no other process of that name was running counts
+            // the intervals of a name are copied for its first process, the next ones add to the copy
+            auto intervals = parallelTracking.find(nameId);
+            if (intervals == parallelTracking.end()) {
+                intervals = parallelTracking.emplace(nameId, nameId < snapshot.parallelTracking.size() ?
+                                                             snapshot.parallelTracking[nameId] : IntervalUnion()).first;
+            }
+            processUptime = intervals->second.add(processStartTime, now);
+        }
+        nameEntry(uptimeBuffer, nameId) += processUptime;
+    }
+    return uptimeBuffer;
+}
+
+/**
+ * How fast the uptime of each name grows while the processes of the snapshot keep running
+ *
+ * Each running process counts, or only whether one runs if parallel processes are not tracked
+ *
+ * @param snapshot : the snapshot
+ *
+ * @return the clock ticks each name gains per clock tick, indexed by name ID
+ */
+std::vector<uint32_t> uptimeRates(const TrackingSnapshot& snapshot) {
+    const ProcessTable& processBuffer = snapshot.processBuffer;
+    std::vector<uint32_t> rates;
+    for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+        if (processBuffer.states[slot] != ProcessTable::LIVE)
+            continue;
+        uint32_t& rate = nameEntry(rates, processBuffer.nameIds[slot]);
+        if (config::track_parallel_processes || rate == 0)
+            ++rate;
+    }
+    return rates;
+}
@@ -0,0 +1,28 @@
+#ifndef YOTTA_SNAPSHOT_HPP
+#define YOTTA_SNAPSHOT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "intervalUnion.hpp"
+#include "processTable.hpp"
+
+/// State of the time tracking at the end of a scan, never modified once published
+struct TrackingSnapshot {
+    uint64_t generation;  ///< increases with each publication
+    int64_t time;         ///< time since boot of the publication, in clock ticks
+    ProcessTable processBuffer;
+    std::vector<int64_t> uptimeBuffer;
+    std::vector<IntervalUnion> parallelTracking;
+    uint64_t journalMark = 0;  ///< bytes of journal records appended when it was taken, from journalMark
+};
+
+void publishSnapshot(const ProcessTable& processBuffer, const std::vector<int64_t>& uptimeBuffer,
+                     const std::vector<IntervalUnion>& parallelTracking);
+std::shared_ptr<const TrackingSnapshot> currentSnapshot();
+int publicationFd();
+std::vector<int64_t> projectUptimes(const TrackingSnapshot& snapshot, int64_t now);
+std::vector<uint32_t> uptimeRates(const TrackingSnapshot& snapshot);
+
+#endif //YOTTA_SNAPSHOT_HPP
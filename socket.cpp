@@ -1,156 +1,925 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
+#include <set>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <unistd.h>
 #include <vector>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
-#include <iostream>
-#include <lcms2.h>
 
+#include "checkpoint.hpp"
 #include "config.hpp"
 #include "log.h"
+#include "nameTable.hpp"
+#include "protocol.hpp"
+#include "snapshot.hpp"
+#include "timebase.hpp"
 #include "util.hpp"
 
 /// Path where the socket file is located
 const char* const SOCKET_PATH = "/run/yotta/yotta_socket";
 
+/// Longest text request a client may send, text requests end with a null character
+const size_t REQUEST_SIZE = 80;
+
+/// Size of the buffer requests are read into
+const size_t READ_SIZE = 4096;
+
+/// Most events handled per call to epoll_wait
+const int MAX_EVENTS = 64;
+
+/// Most bytes queued for a subscriber, one that does not keep up is dropped
+const size_t MAX_PENDING = 1 << 20;
+
+/// Event file written by the signal handler to wake up the socket thread, -1 until the thread created it
+std::atomic<int> wakeFd{-1};
+
+/// Listening socket, only used by the socket thread
+int serverFd = -1;
+
+/// Time since boot the socket thread started, in clock ticks
+int64_t startedAt = 0;
+
+/// Step of the exchange with a client
+enum ConnectionState {
+    READING_REQUEST,  ///< waiting for the whole request
+    WRITING,          ///< sending a message of the answer
+    READING_ACK,      ///< waiting for the client to acknowledge the message
+    SUBSCRIBED,       ///< waiting for the next publication, or for the client to leave
+    WAITING_SAVE,     ///< waiting for the checkpoint of a SAVE_COMMAND, or for the client to leave
+};
+
+/// A client being served
+struct Connection {
+    ConnectionState state = READING_REQUEST;
+    std::string request;
+    std::vector<std::string> messages;  ///< the answer
+    bool acknowledged = true;           ///< whether the client acknowledges each message, as in the text protocol
+    size_t message = 0;                 ///< message being sent
+    size_t offset = 0;                  ///< bytes of the message already sent
+    std::chrono::steady_clock::time_point deadline;  ///< the connection is closed if nothing happens until then
+    bool subscribed = false;            ///< whether the client follows the changes of the uptimes
+    std::set<std::string, std::less<>> watched;  ///< names the subscriber follows, all of them if empty
+    uid_t uid = (uid_t) -1;             ///< user of the client, only root may send an ADMIN_REQUEST
+    uint64_t awaitedCheckpoint = 0;     ///< checkpoint a SAVE_COMMAND waits for, as returned by requestSave
+};
+
+/// Uptimes of a snapshot, as sent to the subscribers
+struct Publication {
+    int64_t time;                  ///< time of the snapshot, in clock ticks
+    std::vector<int64_t> uptimes;  ///< uptime of each name at that time, in clock ticks
+    std::vector<uint32_t> rates;   ///< clock ticks each name gains per clock tick after that time
+};
+
+/// Last publication sent to the subscribers, none while nobody subscribed
+std::optional<Publication> lastPublication;
+
+/// Answers of the last generation asked for, the uptimes of the running names are moved forward at each request
+struct ResponseCache {
+    uint64_t generation = 0;
+    bool built = false;               ///< whether the cache was built once
+    Publication publication;          ///< uptimes when the cache was built, with their rates
+    std::vector<uint32_t> running;    ///< names whose uptime grows
+    std::string response;             ///< UPTIMES_RESPONSE with all the names, as when the cache was built
+    std::vector<size_t> offsets;      ///< where the uptime of each running name is in the response
+    std::vector<std::string> lines;   ///< text lines of the names that are not running
+};
+
+/// Only used by the socket thread
+ResponseCache responseCache;
+
+
 /**
- * Main of the socket thread
+ * Wake up the socket thread so that it handles the signal received
  *
- * Create the socket
- * Wait for a connection to be established
- * Accept and send requested datas
- *
- * @param uptimeBuffer : buffer of already finished processes
- * @param processBuffer : buffer of actually running processes
- * @param gSignalStatus : signal received
+ * Async-signal-safe, called from the signal handler
  */
-void ySocket (std::map <std::string, float>& uptimeBuffer, std::map<int, std::pair<std::string, int>>& processBuffer,
-              volatile sig_atomic_t& gSignalStatus, std::map<std::string, std::vector<std::pair<int, int>>>& parallelTracking) {
-    mask_sig();
-    int sockfd, newsockfd, servlen;
-    socklen_t clilen;
-    struct sockaddr_un cli_addr{}, serv_addr{};
-    char buf[80];
+void wakeSocket () {
+    int fd = wakeFd.load();
+    if (fd >= 0) {
+        uint64_t one = 1;
+        write(fd, &one, sizeof(one));
+    }
+}
 
-    if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+/**
+ * Create the listening socket
+ *
+ * It does not block, and everyone can connect to it
+ *
+ * @return the socket, -1 if it could not be created
+ */
+int openServer () {
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0) {
         error("Creating the socket", FATAL);
+        return -1;
+    }
 
-    int enable = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
-        error("setsockopt(SO_REUSEADDR)", FATAL);
-
-    bzero((char *) &serv_addr, sizeof(serv_addr));
+    struct sockaddr_un serv_addr{};
     serv_addr.sun_family = AF_UNIX;
     strcpy(serv_addr.sun_path, SOCKET_PATH);
-    servlen = strlen(serv_addr.sun_path) + sizeof(serv_addr.sun_family);
+    int servlen = strlen(serv_addr.sun_path) + sizeof(serv_addr.sun_family);
 
     if (std::filesystem::is_socket(SOCKET_PATH))
         unlink(SOCKET_PATH);
 
-    if (bind(sockfd, (struct sockaddr *) &serv_addr, servlen) < 0)
+    if (bind(sockfd, (struct sockaddr *) &serv_addr, servlen) < 0 || listen(sockfd, config::listen_backlog) < 0) {
         error("Binding the socket", FATAL);
-
-    listen(sockfd, 5);
-    clilen = sizeof(cli_addr);
+        close(sockfd);
+        return -1;
+    }
 
     //change the permission of the socket so everyone can run yotta_cli
     std::filesystem::permissions(SOCKET_PATH, std::filesystem::perms::owner_all | std::filesystem::perms::group_all |
                                   std::filesystem::perms::others_all, std::filesystem::perm_options::add);
+    return sockfd;
+}
+
+/**
+ * Get the uptimes answers are built from, projecting them only when the cache can not be used
+ *
+ * The cache is built again when a new snapshot is published, in between the uptimes grow at their rate
+ *
+ * @param now : actual time since boot, in clock ticks
+ *
+ * @return the cache, its uptimes are those at the time it was built
+ */
+const ResponseCache& cachedResponses (int64_t now) {
+    std::shared_ptr<const TrackingSnapshot> snapshot = currentSnapshot();
+    ResponseCache& cache = responseCache;
+    if (cache.built && cache.generation == snapshot->generation)
+        return cache;
+
+    cache.built = true;
+    cache.generation = snapshot->generation;
+    cache.publication = {now, projectUptimes(*snapshot, now), uptimeRates(*snapshot)};
+    std::vector<int64_t>& uptimes = cache.publication.uptimes;
+    std::vector<uint32_t>& rates = cache.publication.rates;
+    size_t size = std::max(uptimes.size(), rates.size());
+    uptimes.resize(size);
+    rates.resize(size);
+
+    cache.running.clear();
+    cache.offsets.clear();
+    cache.lines.clear();
+    std::string payload;
+    uint32_t count = 0;
+    for (uint32_t id = 0; id < size; ++id) {
+        // names without any uptime are not sent, unless they are running
+        if (uptimes[id] == 0 && rates[id] == 0)
+            continue;
+        if (rates[id] != 0) {
+            cache.running.push_back(id);
+            cache.offsets.push_back(sizeof(FrameHeader) + payload.size());
+        } else {
+            cache.lines.push_back(std::string(nameOf(id)) + '\1' + std::to_string(toSeconds(uptimes[id])) + "\n");
+        }
+        appendUptimeRecord(payload, nameOf(id), uptimes[id]);
+        ++count;
+    }
+    FrameHeader header = makeFrameHeader(UPTIMES_RESPONSE, count, payload.size());
+    cache.response = std::string((const char*) &header, sizeof(header)) + payload;
+    return cache;
+}
+
+/**
+ * Uptime of each name at a given time, from the cache
+ *
+ * @param cache : the cache
+ * @param now : actual time since boot, in clock ticks
+ *
+ * @return the uptimes, indexed by name ID, in clock ticks
+ */
+std::vector<int64_t> cachedUptimes (const ResponseCache& cache, int64_t now) {
+    std::vector<int64_t> uptimes = cache.publication.uptimes;
+    int64_t elapsed = now - cache.publication.time;
+    for (uint32_t id : cache.running)
+        uptimes[id] += cache.publication.rates[id] * elapsed;
+    return uptimes;
+}
+
+/**
+ * Build the answer to a text request
+ *
+ * "uptimeBuffer" : the number of lines, then one line "name\1uptime\n" per name, uptimes in seconds
+ *
+ * @param request : the request, without its null character
+ *
+ * @return the messages of the answer, empty if the request is unknown
+ */
+std::vector<std::string> answer (const std::string& request) {
+    std::vector<std::string> messages;
+    if (request != "uptimeBuffer")
+        return messages;
+
+    // only the lines of the running names have to be formatted again
+    int64_t now = bootTicks();
+    const ResponseCache& cache = cachedResponses(now);
+    const Publication& publication = cache.publication;
+    messages.reserve(1 + cache.lines.size() + cache.running.size());
+    messages.emplace_back();
+    messages.insert(messages.end(), cache.lines.begin(), cache.lines.end());
+    for (uint32_t id : cache.running) {
+        int64_t uptime = publication.uptimes[id] + publication.rates[id] * (now - publication.time);
+        messages.push_back(std::string(nameOf(id)) + '\1' + std::to_string(toSeconds(uptime)) + "\n");
+    }
+    messages[0] = std::to_string(messages.size() - 1); // the number of lines that will be sent
+    return messages;
+}
+
+/**
+ * Select the uptimes that answer a query
+ *
+ * @param uptimes : uptime of each name, in clock ticks
+ * @param query : conditions on the uptimes
+ * @param nameIds : the names asked for, all the names if empty
+ *
+ * @return the uptime and the ID of each name selected, the greatest uptimes first if there is a limit
+ */
+std::vector<std::pair<int64_t, uint32_t>> selectUptimes (const std::vector<int64_t>& uptimes, const UptimeQuery& query,
+                                                        const std::vector<uint32_t>& nameIds) {
+    std::vector<std::pair<int64_t, uint32_t>> rows;
+    auto select = [&](uint32_t id) {
+        int64_t uptime = id < uptimes.size() ? uptimes[id] : 0;
+        if (uptime == 0) // names without any uptime are not sent
+            return;
+        if ((query.minUptime && uptime <= query.minUptime) || (query.maxUptime && uptime >= query.maxUptime))
+            return;
+        rows.emplace_back(uptime, id);
+    };
+
+    if (nameIds.empty()) {
+        for (uint32_t id = 0; id < uptimes.size(); ++id)
+            select(id);
+    } else {
+        for (uint32_t id : nameIds)
+            select(id);
+    }
+
+    if (query.limit && rows.size() > query.limit) {
+        std::partial_sort(rows.begin(), rows.begin() + query.limit, rows.end(), std::greater<>());
+        rows.resize(query.limit);
+    }
+    return rows;
+}
+
+/**
+ * Build the answer to a request of the binary protocol
+ *
+ * UPTIMES_REQUEST : one record per name that answers the query
+ * Asking for all the names without conditions copies the cached response, only the uptimes of the running names change
+ * A request of another version, of an unknown type or that is malformed gets an ERROR_RESPONSE
+ *
+ * @param header : header of the request
+ * @param payload : payload of the request
+ *
+ * @return the messages of the answer: the header of the response, then its payload
+ */
+std::vector<std::string> answerFrame (const FrameHeader& header, std::string_view payload) {
+    std::string responsePayload;
+    uint32_t count = 0;
+    FrameType type = ERROR_RESPONSE;
+
+    if (header.version == PROTOCOL_VERSION && header.type == UPTIMES_REQUEST && payload.size() >= sizeof(UptimeQuery)) {
+        UptimeQuery query;
+        memcpy(&query, payload.data(), sizeof(query));
+
+        // names that were never seen have no uptime, they are left out
+        std::vector<uint32_t> nameIds;
+        const char* cursor = payload.data() + sizeof(query);
+        std::string_view name;
+        uint32_t id;
+        bool wellFormed = true;
+        for (uint32_t i = 0; i < header.count && wellFormed; ++i) {
+            wellFormed = readName(cursor, payload.data() + payload.size(), name);
+            if (wellFormed && findName(name, id))
+                nameIds.push_back(id);
+        }
+        std::sort(nameIds.begin(), nameIds.end());
+        nameIds.erase(std::unique(nameIds.begin(), nameIds.end()), nameIds.end());
+
+        int64_t now = bootTicks();
+        if (wellFormed && header.count == 0 && !query.minUptime && !query.maxUptime && !query.limit) {
+            const ResponseCache& cache = cachedResponses(now);
+            const Publication& publication = cache.publication;
+            std::string response = cache.response;
+            for (size_t i = 0; i < cache.running.size(); ++i) {
+                uint32_t id = cache.running[i];
+                int64_t uptime = publication.uptimes[id] + publication.rates[id] * (now - publication.time);
+                memcpy(response.data() + cache.offsets[i], &uptime, sizeof(uptime));
+            }
+            return {std::move(response)};
+        }
 
+        // asked for names that do not exist, nothing answers
+        if (wellFormed && (header.count == 0 || !nameIds.empty())) {
+            std::vector<int64_t> uptimes = cachedUptimes(cachedResponses(now), now);
+            for (auto& row : selectUptimes(uptimes, query, nameIds)) {
+                appendUptimeRecord(responsePayload, nameOf(row.second), row.first);
+                ++count;
+            }
+        }
+        if (wellFormed)
+            type = UPTIMES_RESPONSE;
+    }
+    FrameHeader responseHeader = makeFrameHeader(type, count, responsePayload.size());
+    return {std::string((const char*) &responseHeader, sizeof(responseHeader)), std::move(responsePayload)};
+}
+
+/**
+ * Reload the config file
+ *
+ * The listening socket takes the new backlog
+ */
+void reload () {
+    reloadConfig();
+    listen(serverFd, config::listen_backlog);
+}
+
+/**
+ * Describe the state of the daemon, for STATS_COMMAND
+ *
+ * @return one "name: value" line each
+ */
+std::string stats () {
+    std::shared_ptr<const TrackingSnapshot> snapshot = currentSnapshot();
+    int64_t now = bootTicks();
+    int64_t checkpoint = lastCheckpoint();
+    auto seconds = [] (int64_t ticks) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.2f s", toSeconds(ticks));
+        return std::string(buf);
+    };
+    std::string text;
+    text += "pid: " + std::to_string(getpid()) + "\n";
+    text += "running for: " + seconds(now - startedAt) + "\n";
+    text += "protocol version: " + std::to_string(PROTOCOL_VERSION) + "\n";
+    text += "snapshots published: " + std::to_string(snapshot->generation) + "\n";
+    text += "last snapshot: " + seconds(now - snapshot->time) + " ago\n";
+    text += "processes running: " + std::to_string(snapshot->processBuffer.size()) + "\n";
+    text += "names known: " + std::to_string(nameCount()) + "\n";
+    text += "last checkpoint: " + (checkpoint ? seconds(now - checkpoint) + " ago\n" : std::string("none\n"));
+    return text;
+}
+
+/**
+ * Build an ADMIN_RESPONSE
+ *
+ * @param status : outcome of the command
+ * @param text : text of the answer
+ *
+ * @return the messages of the answer: the header of the ADMIN_RESPONSE, then its text
+ */
+std::vector<std::string> adminResponse (AdminStatus status, std::string text) {
+    FrameHeader responseHeader = makeFrameHeader(ADMIN_RESPONSE, status, text.size());
+    return {std::string((const char*) &responseHeader, sizeof(responseHeader)), std::move(text)};
+}
+
+/**
+ * Run an admin command and build its answer
+ *
+ * Only root may run them, as told by the credentials of the client when it connected
+ * A SAVE_COMMAND only asks for a checkpoint, its answer is built by the event loop once the checkpoint is attempted
+ * The SHUTDOWN_COMMAND stops the daemon as SIGTERM does, the answer is sent before the socket thread sees it
+ *
+ * @param connection : the client, told which checkpoint to wait for by a SAVE_COMMAND
+ * @param header : header of the ADMIN_REQUEST, its count is the command
+ *
+ * @return the messages of the answer: the header of the ADMIN_RESPONSE, then its text, none for a SAVE_COMMAND
+ */
+std::vector<std::string> answerAdmin (Connection& connection, const FrameHeader& header) {
+    AdminStatus status = ADMIN_DONE;
+    std::string text;
+    if (connection.uid != 0) {
+        status = ADMIN_DENIED;
+    } else {
+        switch (header.count) {
+            case SAVE_COMMAND:
+                connection.awaitedCheckpoint = requestSave();
+                return {};
+            case RELOAD_COMMAND:
+                reload();
+                break;
+            case CHECKPOINT_COMMAND:
+                requestCheckpoint(); // the buffers belong to the tracking thread
+                break;
+            case SHUTDOWN_COMMAND:
+                kill(getpid(), SIGTERM); // handled by the main thread, as when the service is stopped
+                break;
+            case STATS_COMMAND:
+                text = stats();
+                break;
+            default:
+                status = ADMIN_UNKNOWN;
+        }
+    }
+    return adminResponse(status, std::move(text));
+}
+
+/**
+ * Uptimes of a snapshot and how fast they grow
+ *
+ * @param snapshot : the snapshot
+ *
+ * @return the publication, uptimes and rates are indexed by name ID and of the same size
+ */
+Publication makePublication (const TrackingSnapshot& snapshot) {
+    Publication publication{snapshot.time, projectUptimes(snapshot, snapshot.time), uptimeRates(snapshot)};
+    size_t size = std::max(publication.uptimes.size(), publication.rates.size());
+    publication.uptimes.resize(size);
+    publication.rates.resize(size);
+    return publication;
+}
+
+/**
+ * Build an UPTIMES_DELTA for a subscriber
+ *
+ * @param publication : the uptimes to send
+ * @param nameIds : the names that changed
+ * @param watched : names the subscriber follows, all of them if empty
+ *
+ * @return the frame, empty if none of the names is followed
+ */
+std::string makeDelta (const Publication& publication, const std::vector<uint32_t>& nameIds,
+                       const std::set<std::string, std::less<>>& watched) {
+    std::string payload((const char*) &publication.time, sizeof(publication.time));
+    uint32_t count = 0;
+    for (uint32_t id : nameIds) {
+        std::string_view name = nameOf(id);
+        if (!watched.empty() && watched.find(name) == watched.end())
+            continue;
+        appendDeltaRecord(payload, name, publication.uptimes[id], publication.rates[id]);
+        ++count;
+    }
+    if (count == 0)
+        return std::string();
+    FrameHeader header = makeFrameHeader(UPTIMES_DELTA, count, payload.size());
+    return std::string((const char*) &header, sizeof(header)) + payload;
+}
+
+/**
+ * Names whose uptime does not follow what the previous publication announced
+ *
+ * A name changes when its rate changes, or when its uptime is not the previous one grown at the previous rate
+ *
+ * @param previous : the publication the subscribers know
+ * @param publication : the new publication
+ *
+ * @return the IDs of the names that changed
+ */
+std::vector<uint32_t> changedNames (const Publication& previous, const Publication& publication) {
+    std::vector<uint32_t> nameIds;
+    int64_t elapsed = publication.time - previous.time;
+    for (uint32_t id = 0; id < publication.uptimes.size(); ++id) {
+        int64_t uptime = id < previous.uptimes.size() ? previous.uptimes[id] : 0;
+        uint32_t rate = id < previous.rates.size() ? previous.rates[id] : 0;
+        if (publication.rates[id] != rate || publication.uptimes[id] != uptime + rate * elapsed)
+            nameIds.push_back(id);
+    }
+    return nameIds;
+}
+
+/**
+ * Queue a frame for a subscriber
+ *
+ * @param connection : the subscriber
+ * @param frame : the frame, nothing is queued if empty
+ *
+ * @return true  : if the frame is queued
+ *         false : if the subscriber has too much left to read and has to be dropped
+ */
+bool push (Connection& connection, std::string frame) {
+    if (frame.empty())
+        return true;
+    size_t pending = frame.size() - connection.offset;
+    for (size_t i = connection.message; i < connection.messages.size(); ++i)
+        pending += connection.messages[i].size();
+    if (pending > MAX_PENDING)
+        return false;
+    connection.messages.push_back(std::move(frame));
+    if (connection.state == SUBSCRIBED)
+        connection.state = WRITING;
+    return true;
+}
+
+/**
+ * Start following the uptimes
+ *
+ * The subscriber first receives all the names it follows that have an uptime, then only those that changed
+ *
+ * @param connection : the subscriber
+ * @param header : header of the SUBSCRIBE_REQUEST
+ * @param payload : payload of the SUBSCRIBE_REQUEST
+ *
+ * @return true  : if the request is well-formed
+ *         false : if it is not
+ */
+bool subscribe (Connection& connection, const FrameHeader& header, std::string_view payload) {
+    if (payload.size() < sizeof(UptimeQuery))
+        return false;
+    const char* cursor = payload.data() + sizeof(UptimeQuery);
+    std::string_view name;
+    for (uint32_t i = 0; i < header.count; ++i) {
+        if (!readName(cursor, payload.data() + payload.size(), name))
+            return false;
+        connection.watched.emplace(name);
+    }
+
+    // without subscribers no publication was kept, the current snapshot becomes the reference
+    if (!lastPublication)
+        lastPublication = makePublication(*currentSnapshot());
+    std::vector<uint32_t> nameIds;
+    for (uint32_t id = 0; id < lastPublication->uptimes.size(); ++id) {
+        if (lastPublication->uptimes[id] != 0 || lastPublication->rates[id] != 0)
+            nameIds.push_back(id);
+    }
+
+    // an empty delta still tells the client that the subscription started
+    std::string frame = makeDelta(*lastPublication, nameIds, connection.watched);
+    if (frame.empty()) {
+        FrameHeader deltaHeader = makeFrameHeader(UPTIMES_DELTA, 0, sizeof(lastPublication->time));
+        frame = std::string((const char*) &deltaHeader, sizeof(deltaHeader)) +
+                std::string((const char*) &lastPublication->time, sizeof(lastPublication->time));
+    }
+    connection.subscribed = true;
+    connection.acknowledged = false;
+    connection.messages = {std::move(frame)};
+    return true;
+}
+
+/**
+ * Send what changed since the last publication to the subscribers
+ *
+ * @param connections : the clients being served
+ * @param epollFd : the epoll instance of the socket thread
+ * @param deadline : when the subscribers that are sent something have to have read it
+ *
+ * @return the sockets of the subscribers that have to be dropped
+ */
+std::vector<int> publish (std::map<int, Connection>& connections, int epollFd,
+                          std::chrono::steady_clock::time_point deadline) {
+    std::vector<int> dropped;
+    bool subscribers = std::any_of(connections.begin(), connections.end(),
+                                   [](auto& connection) { return connection.second.subscribed; });
+    if (!subscribers) {
+        lastPublication.reset();
+        return dropped;
+    }
+
+    Publication publication = makePublication(*currentSnapshot());
+    std::vector<uint32_t> nameIds = lastPublication ? changedNames(*lastPublication, publication)
+                                                    : std::vector<uint32_t>();
+    if (!nameIds.empty()) {
+        struct epoll_event event{};
+        for (auto& [fd, connection] : connections) {
+            if (!connection.subscribed || connection.state == READING_REQUEST)
+                continue;
+            bool idle = connection.state == SUBSCRIBED;
+            if (!push(connection, makeDelta(publication, nameIds, connection.watched))) {
+                dropped.push_back(fd);
+            } else if (idle && connection.state == WRITING) {
+                event.events = EPOLLOUT;
+                event.data.fd = fd;
+                epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+                connection.deadline = deadline;
+            }
+        }
+    }
+    lastPublication = std::move(publication);
+    return dropped;
+}
+
+/**
+ * Read the request of a client
+ *
+ * A request is either text ending with a null character, or a frame of the binary protocol
+ * An ADMIN_REQUEST is run as soon as it is read, a SAVE_COMMAND leaves the answer empty until its checkpoint
+ *
+ * @param connection : state of the exchange, its request is complete once its answer is built
+ *
+ * @return true  : if the request is complete or may still be
+ *         false : if it can not be a valid request
+ */
+bool parseRequest (Connection& connection) {
+    const std::string& request = connection.request;
+    if (request.compare(0, sizeof(PROTOCOL_MAGIC), PROTOCOL_MAGIC, std::min(request.size(), sizeof(PROTOCOL_MAGIC))) != 0) {
+        size_t end = request.find('\0');
+        if (end == std::string::npos)
+            return request.size() < REQUEST_SIZE;
+        connection.messages = answer(request.substr(0, end));
+        connection.acknowledged = true;
+        return !connection.messages.empty();
+    }
+
+    if (request.size() < sizeof(FrameHeader))
+        return true;
+    FrameHeader header;
+    memcpy(&header, request.data(), sizeof(header));
+    if (header.length > MAX_REQUEST_PAYLOAD)
+        return false;
+    if (request.size() < sizeof(header) + header.length)
+        return true;
+    if (header.version == PROTOCOL_VERSION && header.type == SUBSCRIBE_REQUEST &&
+        subscribe(connection, header, std::string_view(request).substr(sizeof(header), header.length)))
+        return true;
+    if (header.version == PROTOCOL_VERSION && header.type == ADMIN_REQUEST)
+        connection.messages = answerAdmin(connection, header);
+    else
+        connection.messages = answerFrame(header, std::string_view(request).substr(sizeof(header), header.length));
+    connection.acknowledged = false;
+    return true;
+}
+
+/**
+ * Move the exchange with a client forward as far as possible without blocking
+ *
+ * With the text protocol the client acknowledges each message before the next one is sent
+ * With the binary protocol the whole answer is gathered in as few sends as possible
+ * A subscriber waits for the next publication once all its frames are sent
+ * A SAVE_COMMAND waits for its checkpoint, the event loop then gives it its answer
+ *
+ * @param fd : socket of the client
+ * @param connection : state of the exchange
+ *
+ * @return true  : if the exchange goes on
+ *         false : if it is over, or the client left or misbehaved, and the connection has to be closed
+ */
+bool serve (int fd, Connection& connection) {
+    char buf[READ_SIZE];
     while (true) {
-        while (true) {
-            int select_status;
-
-            fd_set read_fds;
-            FD_ZERO(&read_fds);
-            FD_SET(sockfd, &read_fds);
-
-            struct timeval timeout{};
-            timeout.tv_sec = 1;  // 1s timeout
-            timeout.tv_usec = 0;
-
-            select_status = select(sockfd+1, &read_fds, nullptr, nullptr, &timeout); //check if there is a client
-            if (select_status == -1) { //error
-                error("Selecting the socket connection", ERROR);
-            } else if (select_status > 0) { //at least one client
-                break;  // we have data, we can accept now
+        ssize_t n;
+        switch (connection.state) {
+            case READING_REQUEST:
+                n = read(fd, buf, sizeof(buf));
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return true;
+                if (n <= 0)
+                    return false;
+                connection.request.append(buf, n);
+                if (!parseRequest(connection))
+                    return false;
+                if (!connection.messages.empty()) {
+                    connection.state = WRITING;
+                } else if (connection.awaitedCheckpoint != 0) {
+                    connection.state = WAITING_SAVE;
+                    return true;
+                }
+                break;
+
+            case WRITING: {
+                // the text protocol sends one message at a time, the binary one all those left
+                struct iovec iov[2];
+                size_t last = connection.acknowledged ? connection.message + 1 : connection.messages.size();
+                struct msghdr msg{};
+                msg.msg_iov = iov;
+                for (size_t i = connection.message; i < last && msg.msg_iovlen < 2; ++i) {
+                    size_t offset = i == connection.message ? connection.offset : 0;
+                    iov[msg.msg_iovlen].iov_base = connection.messages[i].data() + offset;
+                    iov[msg.msg_iovlen++].iov_len = connection.messages[i].size() - offset;
+                }
+                n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return true;
+                if (n < 0)
+                    return false;
+
+                connection.offset += n;
+                while (connection.message < last && connection.offset >= connection.messages[connection.message].size()) {
+                    connection.offset -= connection.messages[connection.message].size();
+                    ++connection.message;
+                }
+                if (connection.message < last)
+                    break;
+                if (connection.subscribed) {
+                    connection.messages.clear();
+                    connection.message = 0;
+                    connection.state = SUBSCRIBED;
+                    return true;
+                }
+                if (!connection.acknowledged)
+                    return false; // all sent
+                connection.state = READING_ACK;
+                break;
             }
-            // otherwise check signals
+
+            case READING_ACK:
+                n = read(fd, buf, 1); // to receive the "ok, received"
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return true;
+                if (n <= 0 || connection.message == connection.messages.size())
+                    return false;
+                connection.state = WRITING;
+                break;
+
+            case SUBSCRIBED:
+            case WAITING_SAVE:
+                n = read(fd, buf, sizeof(buf)); // the client has nothing more to say, only its leaving matters
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return true;
+                if (n <= 0)
+                    return false;
+                break;
+        }
+    }
+}
+
+/**
+ * Close the connection with a client
+ *
+ * @param epollFd : the epoll instance of the socket thread
+ * @param connections : the clients being served
+ * @param fd : socket of the client
+ */
+void closeConnection (int epollFd, std::map<int, Connection>& connections, int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+}
+
+/**
+ * Answer a SAVE_COMMAND whose checkpoint was attempted, or that waited too long
+ *
+ * @param epollFd : the epoll instance of the socket thread
+ * @param fd : socket of the client
+ * @param connection : state of the exchange, waiting for the checkpoint
+ * @param status : ADMIN_DONE if the checkpoint was written, ADMIN_FAILED otherwise
+ * @param deadline : when the client has to have read the answer
+ */
+void answerSave (int epollFd, int fd, Connection& connection, AdminStatus status,
+                 std::chrono::steady_clock::time_point deadline) {
+    connection.messages = adminResponse(status, std::string());
+    connection.state = WRITING;
+    connection.deadline = deadline;
+    struct epoll_event event{};
+    event.events = EPOLLOUT;
+    event.data.fd = fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+}
+
+/**
+ * Main of the socket thread
+ *
+ * Create the socket
+ * Serve all the clients from a single epoll loop, a client that does not move forward for client_timeout is dropped
+ * Answer with the last snapshot published by the tracking thread
+ * Run the admin commands of root, which are told apart by the credentials of the client
+ * A SAVE_COMMAND is answered once the checkpoint thread tells its checkpoint was attempted, or failed after
+ * client_timeout, the other clients are served meanwhile
+ * After each publication, push to the subscribers the uptimes that changed
+ * A subscriber is never dropped while it waits, only when it does not read what it is sent
+ * Sleep while there is nothing to do, the signal handler wakes the thread up
+ *
+ * @param gSignalStatus : signal received
+ */
+void ySocket (volatile sig_atomic_t& gSignalStatus) {
+    mask_sig();
+    int sockfd = openServer();
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    int signalFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sockfd < 0 || epollFd < 0 || signalFd < 0) {
+        error("Creating the socket event loop", FATAL);
+        return;
+    }
+    wakeFd = signalFd;
+    serverFd = sockfd;
+    startedAt = bootTicks();
+    int updateFd = publicationFd();
+    int savedFd = checkpointFd();
+
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = sockfd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, sockfd, &event);
+    event.data.fd = signalFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+    event.data.fd = updateFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, updateFd, &event);
+    event.data.fd = savedFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, savedFd, &event);
+
+    std::map<int, Connection> connections;
+    struct epoll_event events[MAX_EVENTS];
+    // a signal received before the event file existed did not wake anyone up
+    bool signaled = gSignalStatus != 0;
+
+    while (true) {
+        if (signaled) {
+            signaled = false;
             if (gSignalStatus == SIGTERM) {
+                for (auto& connection : connections)
+                    close(connection.first);
+                wakeFd = -1;
+                close(signalFd);
+                close(epollFd);
                 close(sockfd);
                 unlink(SOCKET_PATH);
                 return;
-            } else if (gSignalStatus == SIGUSR1)
-                saveData(uptimeBuffer);
-            else if (gSignalStatus == SIGUSR2)
-                reloadConfig();
+            } else if (gSignalStatus == SIGUSR1) {
+                requestCheckpoint(); // the buffers belong to the tracking thread
+            } else if (gSignalStatus == SIGUSR2) {
+                reload();
+            }
         }
-        newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
 
-        if (newsockfd < 0) {
-                error("Accepting the connection", ERROR);
+        // sleep until the nearest deadline
+        int timeout = -1;
+        auto now = std::chrono::steady_clock::now();
+        for (auto& connection : connections) {
+            if (connection.second.state == SUBSCRIBED)
+                continue;
+            long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(connection.second.deadline - now).count() + 1;
+            if (remaining < 0)
+                remaining = 0;
+            if (timeout < 0 || remaining < timeout)
+                timeout = remaining;
         }
 
+        int ready = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+        if (ready < 0 && errno != EINTR)
+            error("Waiting for the socket events", ERROR);
 
-        bzero(buf, 80);
-        read(newsockfd, buf, 80);
-
-
-        int CLK_TCK = sysconf(_SC_CLK_TCK);
-        float systemUptime = getSystemUptime();
-        std::string processName;
-        float processUptime;
-
-        // Store the data in buffers to prevent them from changing
-        // and to be able to modify them without any repercussions on the time tracking part
-        std::map <int, std::pair<std::string, int>> processBufBuf = processBuffer;
-        std::map <std::string, float> uptimeBufBuf = uptimeBuffer;
-        std::map <std::string, std::vector<std::pair<int, int>>> parallelTrackingBuf = parallelTracking;
-
-        for (auto& s : processBufBuf) {
-            processName = s.second.first;
-            float processStartTime = s.second.second;
-
-            if (!config::track_parallel_processes && parallelTrackingBuf.contains(processName)) {
-                //if i don't want to track parallel running processes, i check if it is one
-                for (auto t = parallelTrackingBuf[processName].begin(); t != parallelTrackingBuf[processName].end(); ++t) {
-                    if (processStartTime >= t->first && processStartTime <= t->second) {
-                        //if the processes started when another was running, change the time it started
-                        processStartTime = t->second;
-                    } else if (processStartTime < t->first) {
-                        //if the process started before another start (and obviously ended after), remove the included uptime
-                        float includedUptime = t->second - t->first;
-                        uptimeBufBuf[processName] -= includedUptime / CLK_TCK;
-                        parallelTrackingBuf[processName].erase(t--); //decrement the iterator because we erase an element
-                                                                     //it is decremented after having been passed to erase
-                    }
+        now = std::chrono::steady_clock::now();
+        auto deadline = now + std::chrono::milliseconds((long) (config::client_timeout * 1000));
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == signalFd) {
+                uint64_t count;
+                read(signalFd, &count, sizeof(count));
+                signaled = true;
+            } else if (fd == updateFd) {
+                uint64_t count;
+                read(updateFd, &count, sizeof(count));
+                for (int dropped : publish(connections, epollFd, deadline))
+                    closeConnection(epollFd, connections, dropped);
+            } else if (fd == savedFd) {
+                uint64_t count;
+                read(savedFd, &count, sizeof(count));
+                for (auto& [client, connection] : connections) {
+                    bool written;
+                    if (connection.state == WAITING_SAVE && checkpointSaved(connection.awaitedCheckpoint, written))
+                        answerSave(epollFd, client, connection, written ? ADMIN_DONE : ADMIN_FAILED, deadline);
+                }
+            } else if (fd == sockfd) {
+                int newsockfd;
+                while ((newsockfd = accept4(sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    event.events = EPOLLIN;
+                    event.data.fd = newsockfd;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, newsockfd, &event);
+                    Connection& connection = connections[newsockfd];
+                    connection.deadline = deadline;
+                    struct ucred credentials{};
+                    socklen_t length = sizeof(credentials);
+                    if (getsockopt(newsockfd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0)
+                        connection.uid = credentials.uid;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    error("Accepting the connection", ERROR);
+            } else {
+                auto connection = connections.find(fd);
+                if (connection == connections.end())
+                    continue;
+                // a client waiting for its checkpoint keeps the deadline it started waiting with
+                bool waiting = connection->second.state == WAITING_SAVE;
+                if (!serve(fd, connection->second)) {
+                    closeConnection(epollFd, connections, fd);
+                    continue;
                 }
+                event.events = connection->second.state == WRITING ? EPOLLOUT : EPOLLIN;
+                event.data.fd = fd;
+                epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+                if (!waiting)
+                    connection->second.deadline = deadline;
             }
-
-            processUptime = systemUptime - (processStartTime / CLK_TCK) - (config::precision / 2); //to average
-            if (processUptime < 0) // averaging a very short uptime may cause a negative uptime
-                processUptime = 0;
-            uptimeBufBuf[processName] += processUptime;
-            if (!config::track_parallel_processes)
-                parallelTrackingBuf[processName].push_back(std::make_pair(processStartTime, systemUptime*CLK_TCK)); //we store in clock ticks
         }
 
-        if(strcmp(buf, "uptimeBuffer\0") == 0) {
-            std::string bufferSize = std::to_string(uptimeBufBuf.size());
-            write(newsockfd, bufferSize.c_str(), bufferSize.size()); // send the number of lines that will be sent
-            read(newsockfd, buf, 1);
-
-            for (auto &s : uptimeBufBuf) {
-                buf[0] = '\0';
-                std::string toSend = s.first + '\1' + std::to_string(s.second) + "\n";
-                write(newsockfd, toSend.c_str(), toSend.length());
-                read(newsockfd, buf, 1); //to receive the "ok, received"
+        // drop the clients that stopped moving forward, those that waited too long for their checkpoint are told
+        for (auto connection = connections.begin(); connection != connections.end();) {
+            int fd = connection->first;
+            bool expired = connection->second.state != SUBSCRIBED && connection->second.deadline <= now;
+            if (expired && connection->second.state == WAITING_SAVE) {
+                answerSave(epollFd, fd, connection->second, ADMIN_FAILED, deadline);
+                expired = false;
             }
+            ++connection;
+            if (expired)
+                closeConnection(epollFd, connections, fd);
         }
-        close(newsockfd);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,169 @@
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.hpp"
+#include "nameTable.hpp"
+#include "state.hpp"
+#include "timebase.hpp"
+
+
+/**
+ * Write the state of the tracking, when the daemon stops or with a checkpoint
+ *
+ * It is written next to its path then renamed, a daemon starting sees either no state or a whole one
+ *
+ * @param path : STATE_FILE, or CHECKPOINT_STATE_FILE
+ * @param processBuffer : buffer of still active processes
+ * @param uptimeBuffer : buffer of finished processes not saved yet, empty for a checkpoint that saves them apart
+ * @param parallelTracking : buffer of start/end time of each processes
+ * @param stoppedAt : time since boot the processes were counted until, in clock ticks
+ * @param journalSequence : journal closed by the checkpoint, or the one holding the uptimes when the daemon stops
+ *
+ * @return true  : if the state was written
+ *         false : otherwise, the buffers have to be saved, the running processes as if they had ended
+ */
+bool writeState(const char* path, const ProcessTable& processBuffer, const std::vector<int64_t>& uptimeBuffer,
+                const std::vector<IntervalUnion>& parallelTracking, int64_t stoppedAt, uint64_t journalSequence) {
+    std::string id = bootId();
+    if (id.empty())
+        return false;
+
+    StateHeader header{};
+    memcpy(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+    header.version = STATE_VERSION;
+    header.ticksPerSecond = ticksPerSecond();
+    header.stoppedAt = stoppedAt;
+    header.journalSequence = journalSequence;
+    strncpy(header.bootId, id.c_str(), sizeof(header.bootId) - 1);
+
+    std::string names;
+    std::map<uint32_t, uint32_t> nameOffsets;
+    auto nameOffset = [&] (uint32_t nameId) {
+        auto offset = nameOffsets.try_emplace(nameId, names.size());
+        if (offset.second)
+            names += nameOf(nameId);
+        return offset.first->second;
+    };
+
+    std::vector<StateProcess> processes;
+    processes.reserve(processBuffer.size());
+    for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+        if (processBuffer.states[slot] != ProcessTable::LIVE)
+            continue;
+        uint32_t nameId = processBuffer.nameIds[slot];
+        processes.push_back({processBuffer.startTimes[slot], processBuffer.pids[slot], nameOffset(nameId),
+                             (uint32_t) nameOf(nameId).size(), 0});
+    }
+    std::vector<StateInterval> intervals;
+    for (uint32_t nameId = 0; nameId < parallelTracking.size(); ++nameId) {
+        for (auto& span : parallelTracking[nameId].spans())
+            intervals.push_back({span.first, span.second, nameOffset(nameId), (uint32_t) nameOf(nameId).size()});
+    }
+    std::vector<StateUptime> uptimes;
+    for (uint32_t nameId = 0; nameId < uptimeBuffer.size(); ++nameId) {
+        if (uptimeBuffer[nameId] != 0)
+            uptimes.push_back({uptimeBuffer[nameId], nameOffset(nameId), (uint32_t) nameOf(nameId).size()});
+    }
+    header.processCount = processes.size();
+    header.intervalCount = intervals.size();
+    header.uptimeCount = uptimes.size();
+    header.namesSize = names.size();
+
+    std::string temporary = std::string(path) + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = write(fd, &header, sizeof(header)) == sizeof(header) &&
+                   write(fd, processes.data(), processes.size() * sizeof(StateProcess)) == (ssize_t) (processes.size() * sizeof(StateProcess)) &&
+                   write(fd, intervals.data(), intervals.size() * sizeof(StateInterval)) == (ssize_t) (intervals.size() * sizeof(StateInterval)) &&
+                   write(fd, uptimes.data(), uptimes.size() * sizeof(StateUptime)) == (ssize_t) (uptimes.size() * sizeof(StateUptime)) &&
+                   write(fd, names.data(), names.size()) == (ssize_t) names.size() &&
+                   fsync(fd) == 0;
+    close(fd);
+    if (!written || rename(temporary.c_str(), path) < 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Restore the state written by the daemon that stopped last, or with its last checkpoint
+ *
+ * The state is removed once read, it only follows the stop or the checkpoint that wrote it: after a crash, the state
+ * of an earlier stop must not be restored
+ *
+ * @param path : STATE_FILE, or CHECKPOINT_STATE_FILE
+ * @param processBuffer : filled with the processes running when the state was written
+ * @param uptimeBuffer : filled with the uptimes of the finished processes it holds
+ * @param parallelTracking : filled with the intervals of the parallel tracking
+ * @param stoppedAt : filled with the time since boot the processes were counted until, in clock ticks
+ * @param sameBoot : whether the state was written during the current boot, the times are only valid then
+ * @param journalSequence : filled with the journal closed by the checkpoint, or the one whose uptimes a stop holds
+ *
+ * @return true  : if a state was restored
+ *         false : if there is none or it is not a state of this version
+ */
+bool loadState(const char* path, ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+               std::vector<IntervalUnion>& parallelTracking, int64_t& stoppedAt, bool& sameBoot,
+               uint64_t& journalSequence) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    unlink(path);
+    struct stat st{};
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(StateHeader)) {
+        close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const char* data = (const char*) mapping;
+    const StateHeader* header = (const StateHeader*) data;
+    if (memcmp(header->magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0 || header->version != STATE_VERSION ||
+        header->ticksPerSecond != (uint64_t) ticksPerSecond() ||
+        sizeof(StateHeader) + header->processCount * sizeof(StateProcess) +
+        header->intervalCount * sizeof(StateInterval) + header->uptimeCount * sizeof(StateUptime) +
+        header->namesSize != (size_t) st.st_size) {
+        munmap(mapping, st.st_size);
+        return false;
+    }
+    const auto* processes = (const StateProcess*) (data + sizeof(StateHeader));
+    const auto* intervals = (const StateInterval*) (processes + header->processCount);
+    const auto* uptimes = (const StateUptime*) (intervals + header->intervalCount);
+    const char* names = (const char*) (uptimes + header->uptimeCount);
+    auto name = [&] (uint32_t offset, uint32_t length) {
+        if ((uint64_t) offset + length > header->namesSize)
+            return std::string_view();
+        return std::string_view(names + offset, length);
+    };
+
+    for (uint32_t process = 0; process < header->processCount; ++process) {
+        const StateProcess& p = processes[process];
+        processBuffer.insert(p.pid, internName(name(p.nameOffset, p.nameLength)), p.startTime);
+    }
+    for (uint64_t interval = 0; interval < header->intervalCount; ++interval) {
+        const StateInterval& i = intervals[interval];
+        nameEntry(parallelTracking, internName(name(i.nameOffset, i.nameLength))).add(i.start, i.end);
+    }
+    for (uint64_t uptime = 0; uptime < header->uptimeCount; ++uptime) {
+        const StateUptime& u = uptimes[uptime];
+        nameEntry(uptimeBuffer, internName(name(u.nameOffset, u.nameLength))) += u.uptime;
+    }
+    stoppedAt = header->stoppedAt;
+    journalSequence = header->journalSequence;
+    sameBoot = strncmp(header->bootId, bootId().c_str(), sizeof(header->bootId)) == 0;
+    munmap(mapping, st.st_size);
+    return true;
+}
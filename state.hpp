@@ -0,0 +1,70 @@
+#ifndef YOTTA_STATE_HPP
+#define YOTTA_STATE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "intervalUnion.hpp"
+#include "processTable.hpp"
+
+/// Processes running and uptimes not saved yet when the daemon stopped, so that the next daemon goes on counting them
+const char* const STATE_FILE = "/var/lib/yotta/uptime.state";
+
+/// Identifies the state file
+const char STATE_MAGIC[4] = {'Y', 'T', 'S', 'T'};
+
+/// Version of the state format, a state of another version is not read
+const uint16_t STATE_VERSION = 3;
+
+/**
+ * Start of the state file
+ *
+ * It is followed by the processes, then by the intervals of the parallel tracking, then by the uptimes, then by the
+ * names they point into
+ * The file is written and read on the same host, numbers are in its byte order
+ */
+struct StateHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t padding;
+    uint32_t ticksPerSecond;  ///< clock ticks per second of the host that wrote the times
+    uint32_t processCount;
+    uint64_t intervalCount;
+    uint64_t uptimeCount;
+    uint64_t namesSize;       ///< size of the names, in bytes
+    int64_t stoppedAt;        ///< time since boot the processes were counted until, in clock ticks
+    uint64_t journalSequence; ///< journal closed by the checkpoint the state goes with, or whose uptimes the state of a stop holds
+    char bootId[40];          ///< boot_id of the boot the times are counted from, nul terminated
+};
+
+/// A process running when the daemon stopped
+struct StateProcess {
+    int64_t startTime;    ///< clock ticks since boot
+    int32_t pid;
+    uint32_t nameOffset;  ///< where the name starts, from the start of the names
+    uint32_t nameLength;
+    uint32_t padding;
+};
+
+/// An interval of the parallel tracking of a name
+struct StateInterval {
+    int64_t start;        ///< clock ticks since boot
+    int64_t end;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+};
+
+/// Uptime of the processes of a name that finished since the last save
+struct StateUptime {
+    int64_t uptime;       ///< clock ticks
+    uint32_t nameOffset;
+    uint32_t nameLength;
+};
+
+bool writeState(const char* path, const ProcessTable& processBuffer, const std::vector<int64_t>& uptimeBuffer,
+                const std::vector<IntervalUnion>& parallelTracking, int64_t stoppedAt, uint64_t journalSequence);
+bool loadState(const char* path, ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+               std::vector<IntervalUnion>& parallelTracking, int64_t& stoppedAt, bool& sameBoot,
+               uint64_t& journalSequence);
+
+#endif //YOTTA_STATE_HPP
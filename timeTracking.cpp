@@ -1,9 +1,11 @@
+#include <algorithm>
+#include <chrono>
 #include <csignal>
-#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <string>
+#include <thread>
 #include <unistd.h>
 #include <utility>
 #include <vector>
@@ -11,129 +13,144 @@
 #include "log.h"
 #include "util.hpp"
 #include "config.hpp"
+#include "nameTable.hpp"
+#include "exitWatcher.hpp"
+#include "procConnector.hpp"
+#include "processDiff.hpp"
+#include "procfs.hpp"
+#include "timeTracking.hpp"
+#include "intervalUnion.hpp"
+#include "journal.hpp"
+#include "processTable.hpp"
+#include "snapshot.hpp"
+#include "timebase.hpp"
 
 
+/// A process read from /proc, waiting to be added to the process buffer
+struct ProcessEntry {
+    int pid;
+    uint32_t nameId;
+    int64_t startTime;
+};
+
 /**
- * Check if a string contains at least one digit
+ * Read the name and start time of a range of processes
  *
- * @param str : the string to check
+ * @param processes : processes to read
+ * @param begin : first index of the range
+ * @param end : index after the last one of the range
+ * @param entries : the PID, name and start time of each process are appended to it
+ * @param missing : the PID of each process that could not be read is appended to it
+ */
+void readProcessRange(const std::vector<ProcessKey>& processes, size_t begin, size_t end,
+                      std::vector<ProcessEntry>& entries, std::vector<int>& missing) {
+    std::vector<int> pids;
+    pids.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i)
+        pids.push_back(processes[i].pid);
+
+    readProcStats(pids.data(), pids.size(), [&](size_t i, const ProcStat* stat) {
+        if (stat && stat->startTime == processes[begin + i].startTime)
+            entries.push_back({stat->pid, internName(stat->name), stat->startTime});
+        else
+            missing.push_back(pids[i]);
+    });
+}
+
+/**
+ * Add the processes that started to the process buffer
+ *
+ * Their name is only read now, a process that ended or whose PID was reused in the meantime is left out
+ * It will appear as ended in the next diff, which does nothing for a process that is not in the buffer
+ * When there are a lot of them, they are split between several workers and merged in the buffer once they are all read
  *
- * @return true  : if str contains at least a digit
- *         false : if str does not contain any digit
+ * @param processBuffer : the process buffer to update
+ * @param started : processes that started since the last snapshot
  */
-bool containsNumber(std::string& str){
-    return (str.find_first_of("0123456789") != std::string::npos);
+void updateProcessBuffer(ProcessTable& processBuffer, const std::vector<ProcessKey>& started) {
+    size_t shards = shardCount(started.size());
+    std::vector<std::vector<ProcessEntry>> entries(shards);
+    std::vector<std::vector<int>> missing(shards);
+
+    if (shards == 1) {
+        readProcessRange(started, 0, started.size(), entries[0], missing[0]);
+    } else {
+        runSharded(started.size(), shards, [&](size_t shard, size_t begin, size_t end) {
+            readProcessRange(started, begin, end, entries[shard], missing[shard]);
+        });
+    }
+
+    for (size_t shard = 0; shard < shards; ++shard) {
+        for (auto& entry : entries[shard])
+            processBuffer.insert(entry.pid, entry.nameId, entry.startTime);
+        for (auto& pid : missing[shard]) { // the process has certainly finished between the snapshot and now
+            std::string errmsg = "File not found or permission denied : /proc/" + std::to_string(pid) + "/stat";
+            error(errmsg.c_str(), INFO);
+        }
+    }
 }
 
 /**
  * Initiate the process buffer
  *
- * Look for all directories named '/proc/XXXX', each one represent one process
- * In these directories, read './stat', in brackets is the process name and 22th word is process start time since boot
+ * Each PID listed in /proc represent one process
+ * In their directories, read './stat', in brackets is the process name and 22th word is process start time since boot
  *
  * @return process buffer with PID, name and start time
  *
  */
-std::map <int, std::pair<std::string, int>> initProcessBuffer () {
-    std::map <int, std::pair<std::string, int>> processBuffer;
-    std::string path;
-    int pid;
-    int wordCount;
-    int processStartTime;
-    char c;
-
-    for (auto& p: std::filesystem::directory_iterator("/proc")) {
-        if (p.is_directory()) {
-            path = p.path().string();
-            if (containsNumber(path)) {
-                pid = std::stoi(path.substr(6));
-                std::ifstream pidStat(path + "/stat");
-                if (pidStat.is_open()) {
-                    wordCount = 1;
-                    std::string processName;
-                    while (wordCount != 22) {
-                        pidStat.get(c);
-                        if (c == '(') {
-                            int depth = 0;
-                            while (c != ')' || depth != 0) {
-                                if (c == '(')
-                                    depth += 1;
-                                pidStat.get(c);
-                                processName += c;
-                                if (c == ')')
-                                    depth -= 1;
-                            }
-                            processName.pop_back();
-                        }
-                        if (c == ' ')
-                            wordCount += 1;
-                    }
-                    pidStat >> processStartTime;
-                    processBuffer.insert({pid, std::make_pair(processName, processStartTime)});
-                } else { // the process certainly ended between the beginning and the end of the function
-                    std::string errmsg = "Init : File not found or permission denied : " + path + "/stat";
-                    error(errmsg.c_str(), INFO);
-                }
-            }
-        }
-    }
+ProcessTable initProcessBuffer () {
+    ProcessTable processBuffer;
+    std::vector<ProcDirEntry> entries;
+    std::vector<ProcessKey> snapshot;
+
+    if (!listPids(entries))
+        error("Init : Reading /proc", ERROR);
+    takeSnapshot(entries, {}, {}, snapshot);
+    updateProcessBuffer(processBuffer, snapshot);
     return processBuffer;
 }
 
 /**
- * Update the process buffer to match the running processes
+ * Take a snapshot of the processes in the process buffer
  *
- * Processes that were killed had already been deleted from the process buffer. We only need to add the new ones
- * We add processes from after the last 'old' process to the end of newPidList
- * The process to do it is the same than in initProcessBuffer
- * 
- * @param processBuffer : the process buffer to update
- * @param pidList : all PIDs present in the process buffer
- * @param newPidList : all PIDs actually running
- * @param offset : difference between the place of the last process in pidList and his place in newPidList
+ * @param processBuffer : buffer of still active processes
+ * @param snapshot : filled with the identity of each process, sorted by PID
  */
-void updateProcessBuffer(std::map<int, std::pair<std::string, int>>& processBuffer, std::vector<int>& pidList,
-                         std::vector<int>& newPidList, int& offset) {
-    // All of the old processes fits in new processes minus offset. If there are more processes than those in newPL,
-    // I have to add them to the buffer
-    if (pidList.size() - offset < newPidList.size()) {
-        std::string path;
-        int wordCount;
-        char c;
-        int processStartTime;
-
-        // I start from the last old process and add all following process to the buffer
-        for (auto i = pidList.size() - offset; i < newPidList.size(); i++) {
-            path = "/proc/" + std::to_string(newPidList[i]) + "/stat";
-            std::ifstream pidStat(path);
-            if (pidStat.is_open()) {
-                wordCount = 1;
-                std::string processName;
-                while (wordCount != 22) {
-                    pidStat.get(c);
-                    if (c == '(') {
-                        int depth = 0;
-                        while (c != ')' || depth != 0) {
-                            if (c == '(')
-                                depth += 1;
-                            pidStat.get(c);
-                            processName += c;
-                            if (c == ')')
-                                depth -= 1;
-                        }
-                        processName.pop_back();
-                    }
-                    if (c == ' ')
-                        wordCount += 1;
-                }
-                pidStat >> processStartTime;
-                processBuffer.insert({newPidList[i], std::make_pair(processName, processStartTime)});
-            } else { // the process has certainly finished between getNewPidList and now
-                std::string errmsg = "File not found or permission denied : " + path;
-                error(errmsg.c_str(), INFO);
-            }
-        }
+void snapshotProcessBuffer(ProcessTable& processBuffer, std::vector<ProcessKey>& snapshot) {
+    snapshot.clear();
+    snapshot.reserve(processBuffer.size());
+    for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+        if (processBuffer.states[slot] == ProcessTable::LIVE)
+            snapshot.push_back({processBuffer.pids[slot], processBuffer.startTimes[slot]});
     }
+    std::sort(snapshot.begin(), snapshot.end(), [](const ProcessKey& a, const ProcessKey& b) { return a.pid < b.pid; });
+}
+
+/**
+ * Match the process buffer with /proc
+ *
+ * Done after events were lost, and when the buffer was restored from the state left by the previous daemon
+ * Only the start times of the processes are read, the names only for those that started
+ *
+ * @param processBuffer : buffer of still active processes
+ * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
+ * @param parallelTracking : buffer of start/end time of each processes
+ * @param endTime : last time the processes of the buffer were known to run, those that ended are counted until then
+ */
+void resyncProcessBuffer(ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+                         std::vector<IntervalUnion>& parallelTracking, int64_t endTime) {
+    std::vector<ProcDirEntry> entries;
+    std::vector<ProcessKey> snapshot, newSnapshot, started, ended;
+
+    listPids(entries);
+    takeSnapshot(entries, {}, {}, newSnapshot);
+    snapshotProcessBuffer(processBuffer, snapshot);
+    diffProcesses(snapshot, newSnapshot, started, ended);
+
+    for (auto& process : ended)
+        endProcess(processBuffer, uptimeBuffer, parallelTracking, process.pid, endTime);
+    updateProcessBuffer(processBuffer, started);
 }
 
 /**
@@ -146,39 +163,46 @@ void updateProcessBuffer(std::map<int, std::pair<std::string, int>>& processBuff
  *
  * @return uptime buffer with name and uptime since last boot
  */
-std::map<std::string, float> initUptimeBuffer (std::map<int, std::pair<std::string, int>>& processBuffer) {
-    std::map <std::string, float> uptimeBuffer;
-    for (auto& s : processBuffer) {
-        uptimeBuffer.insert({s.second.first, 0});
+std::vector<int64_t> initUptimeBuffer (ProcessTable& processBuffer) {
+    std::vector<int64_t> uptimeBuffer;
+    for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+        if (processBuffer.states[slot] == ProcessTable::LIVE)
+            nameEntry(uptimeBuffer, processBuffer.nameIds[slot]) = 0;
     }
     return uptimeBuffer;
 
 }
 
 /**
- * Get the PID list of running processes
- *
- * Get the numbers of each subdirectories of /proc with numbers in their path
- * The only subdirectories that has numbers in their path are processes
+ * Count the uptime of a process that has just ended and remove it from the process buffer
  *
- * @return the PID list
+ * @param processBuffer : buffer of still active processes
+ * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
+ * @param parallelTracking : buffer of start/end time of each processes
+ * @param pid : PID of the process that ended
+ * @param now : time since boot when the process ended, in clock ticks
  */
-std::vector <int> getNewPidList () {
-    std::vector <int> newPidList;
-    std::string path;
-    int pid;
-    for (auto& p: std::filesystem::directory_iterator("/proc")) {
-        if (p.is_directory()) {
-            path = p.path().string();
-            // get the pid (process) but not the tid (thread)
-            // ./task is only contained in pid directories
-            if (containsNumber(path) && std::filesystem::exists(p.path().string() + "/task")) {
-                pid = std::stoi(path.substr(6));
-                newPidList.push_back(pid);
-            }
-        }
+void endProcess(ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+                std::vector<IntervalUnion>& parallelTracking, int pid, int64_t now) {
+    size_t process = processBuffer.find(pid);
+    if (process == ProcessTable::npos)
+        return;
+
+    uint32_t nameId = processBuffer.nameIds[process];
+    int64_t processStartTime = processBuffer.startTimes[process];
+    now = std::max(now, processStartTime); // an end time guessed by the polling may come before the start
+
+    int64_t processUptime;
+    if (config::track_parallel_processes) {
+        processUptime = now - processStartTime;
+    } else {
+        //if i don't want to track parallel running processes, only the time no other process of that name was running counts
+        processUptime = nameEntry(parallelTracking, nameId).add(processStartTime, now);
     }
-    return newPidList;
+    processBuffer.erase(process); // delete the process that just finished
+    nameEntry(uptimeBuffer, nameId) += processUptime; // add its uptime
+    if (processUptime != 0)
+        journalUptime(nameOf(nameId), processUptime, processStartTime);
 }
 
 /**
@@ -186,118 +210,226 @@ std::vector <int> getNewPidList () {
  *
  * @param processBuffer : buffer of still active processes
  * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
- * @param CLK_TCK : number of clock ticks in a second
  * @param parallelTracking : buffer of start/end time of each processes
+ * @param now : actual time since boot, in clock ticks
  */
-void mergeProcesses(std::map<int, std::pair<std::string, int>>& processBuffer, std::map<std::string, float>& uptimeBuffer,
-                    const int &CLK_TCK, std::map<std::string, std::vector<std::pair<int, int>>>& parallelTracking) {
-
-    float systemUptime = getSystemUptime();
-    std::string processName;
-    float processUptime;
-
-    for (auto& s : processBuffer) {
-        processName = s.second.first;
-        float processStartTime = s.second.second;
-
-        if (!config::track_parallel_processes && parallelTracking.contains(processName)) {
-            //if i don't want to track parallel running processes, i check if it is one
-            for (auto t = parallelTracking[processName].begin(); t != parallelTracking[processName].end(); t++) {
-                if (processStartTime >= t->first && processStartTime <= t->second) {
-                    //if the processes started when another was running, change the time it started
-                    processStartTime = t->second;
-                } else if (processStartTime < t->first) {
-                    //if the process started before another start (and obviously ended after), remove the included uptime
-                    float includedUptime = t->second - t->first;
-                    uptimeBuffer[processName] -= includedUptime / CLK_TCK;
-                    parallelTracking[processName].erase(t--);
-                }
-            }
+void mergeProcesses(ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+                    std::vector<IntervalUnion>& parallelTracking, int64_t now) {
+
+    uint32_t nameId;
+    int64_t processUptime;
+
+    for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+        if (processBuffer.states[slot] != ProcessTable::LIVE)
+            continue;
+        nameId = processBuffer.nameIds[slot];
+        int64_t processStartTime = processBuffer.startTimes[slot];
+
+        if (config::track_parallel_processes) {
+            processUptime = now - processStartTime;
+        } else {
+            //if i don't want to track parallel running processes, only the time no other process of that name was running counts
+            processUptime = nameEntry(parallelTracking, nameId).add(processStartTime, now);
         }
+        nameEntry(uptimeBuffer, nameId) += processUptime;
+    }
+
+}
+
+/**
+ * Forget the intervals of the parallel tracking that no process can overlap anymore
+ *
+ * A process that will be seen can only overlap the intervals that end after now - max_precision, as it may have
+ * started up to a scan before it is seen, and a running one those that end after it started
+ *
+ * @param processBuffer : buffer of still active processes
+ * @param parallelTracking : buffer of start/end time of each processes
+ * @param now : actual time since boot, in clock ticks
+ */
+void compactParallelTracking(ProcessTable& processBuffer, std::vector<IntervalUnion>& parallelTracking, int64_t now) {
+    std::vector<int64_t> horizons(parallelTracking.size(), now - toTicks(config::max_precision));
+    for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+        if (processBuffer.states[slot] == ProcessTable::LIVE && processBuffer.nameIds[slot] < horizons.size())
+            horizons[processBuffer.nameIds[slot]] = std::min(horizons[processBuffer.nameIds[slot]], processBuffer.startTimes[slot]);
+    }
+    for (uint32_t nameId = 0; nameId < parallelTracking.size(); ++nameId)
+        parallelTracking[nameId].compact(horizons[nameId]);
+}
+
+/**
+ * Compute the next polling interval
+ *
+ * Poll twice as often after a change, and slow down while nothing happens
+ * Idle systems wake up rarely and busy ones get a better precision
+ *
+ * @param interval : the current interval, in seconds
+ * @param changed : whether processes started or ended during the last interval
+ *
+ * @return the next interval, between min_precision and max_precision
+ */
+float adaptInterval(float interval, bool changed) {
+    interval = changed ? interval / 2 : interval * 1.5f;
+    if (interval > config::max_precision)
+        interval = config::max_precision;
+    if (interval < config::min_precision)
+        interval = config::min_precision;
+    return interval;
+}
 
-        processUptime = systemUptime - (processStartTime / CLK_TCK) - (config::precision / 2); //to average
-        if (processUptime < 0) // averaging a very short uptime may cause a negative uptime
-            processUptime = 0;
-        uptimeBuffer[processName] += processUptime;
-        if (!config::track_parallel_processes)
-            parallelTracking[processName].push_back(std::make_pair(processStartTime, systemUptime*CLK_TCK)); //we store in clock ticks
+/**
+ * Sleep for an interval, or until SIGTERM is received
+ *
+ * @param interval : time to sleep, in seconds
+ * @param gSignalStatus : signal received by the program
+ */
+void waitInterval(float interval, volatile sig_atomic_t& gSignalStatus) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds((long) (interval * 1000));
+    while (gSignalStatus != SIGTERM && std::chrono::steady_clock::now() < end) {
+        // sleep by steps of at most one second to check the signals
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                end - std::chrono::steady_clock::now(), std::chrono::seconds(1)));
     }
+}
 
+/**
+ * Fill the process buffer when the tracking starts
+ *
+ * A buffer restored from the previous daemon is only matched with /proc, otherwise every process is read
+ *
+ * @param processBuffer : buffer of still active processes
+ * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
+ * @param parallelTracking : buffer of start/end time of each processes
+ * @param resumedFrom : time since boot the previous daemon stopped if the buffers were restored, 0 otherwise
+ */
+void startProcessBuffer(ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+                        std::vector<IntervalUnion>& parallelTracking, int64_t resumedFrom) {
+    if (resumedFrom > 0)
+        resyncProcessBuffer(processBuffer, uptimeBuffer, parallelTracking, resumedFrom);
+    else
+        processBuffer = initProcessBuffer();
 }
 
 /**
  * Main of the thread that count processes uptimes
  *
- * Compare the processes actually running to those that were TT_PRECISION before
+ * If the proc connector is enabled and available, processes are tracked from the kernel events
+ * Otherwise, compare the processes actually running to those that were an interval before
+ * The task counters of the system tell cheaply when nothing changed and the whole comparison can be skipped
+ * If pidfds are available, exits of processes are counted as soon as they happen, up to pidfd_budget processes
  * If one has ended, count the uptime
  * If one is new, add it to the processes running
- * Repeat
+ * Processes are identified by their PID and start time so a reused PID is seen as a new process
+ * Publish a snapshot of the buffers for the socket thread
+ * Repeat until SIGTERM, the caller saves the buffers
  *
  * @param processBuffer : buffer of still active processes
  * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
  * @param gSignalStatus : signal received by the program
  * @param parallelTracking : buffer of start/end time of each processes
+ * @param resumedFrom : time since boot the previous daemon stopped if the buffers were restored, 0 otherwise
  */
-void timeTracking(std::map<std::string, float>& uptimeBuffer, std::map<int, std::pair<std::string, int>>& processBuffer,
-                  volatile sig_atomic_t& gSignalStatus, std::map<std::string, std::vector<std::pair<int, int>>>& parallelTracking) {
+void timeTracking(std::vector<int64_t>& uptimeBuffer, ProcessTable& processBuffer,
+                  volatile sig_atomic_t& gSignalStatus, std::vector<IntervalUnion>& parallelTracking,
+                  int64_t resumedFrom) {
+
+    if (config::proc_connector) {
+        // subscribe before the first scan so that no process can start between the scan and the first event
+        int connector = openProcConnector();
+        if (connector >= 0) {
+            startProcessBuffer(processBuffer, uptimeBuffer, parallelTracking, resumedFrom);
+            publishSnapshot(processBuffer, uptimeBuffer, parallelTracking);
+            procConnectorTracking(connector, uptimeBuffer, processBuffer, gSignalStatus, parallelTracking);
+            closeProcConnector(connector);
+            return;
+        }
+        error("Proc connector unavailable, falling back to polling /proc", WARN);
+    }
 
-    const int CLK_TCK = sysconf(_SC_CLK_TCK);
+    // the counters are read before each scan so that a change during the scan is seen by the next check
+    TaskCounters counters{};
+    TaskCounters newCounters{};
+    bool hasCounters = readTaskCounters(counters);
+    float interval = config::precision;
+    int64_t lastCompaction = 0;
+    int64_t lastCheck = bootTicks(); // the processes that are found ended were still running then
 
-    processBuffer = initProcessBuffer();
-//    uptimeBuffer = initUptimeBuffer(processBuffer); todo check if i need that
-    std::vector <int> pidList = getNewPidList(); //initiate the pidList
+    startProcessBuffer(processBuffer, uptimeBuffer, parallelTracking, resumedFrom);
+    publishSnapshot(processBuffer, uptimeBuffer, parallelTracking);
+    // nothing is listed yet, the first scan reads every process and matches them with the buffer
+    std::vector <ProcDirEntry> entries;
+    std::vector <ProcDirEntry> newEntries;
+    std::vector <ProcessKey> snapshot;
+    std::vector <ProcessKey> newSnapshot;
+    std::vector <ProcessKey> started;
+    std::vector <ProcessKey> ended;
+    snapshotProcessBuffer(processBuffer, snapshot);
+
+    // exits of the watched processes are counted while waiting, the polling only has to find the others
+    ExitWatcher watcher;
+    bool watchExits = config::pidfd_budget > 0 && openExitWatcher(watcher);
+    if (watchExits) {
+        for (size_t slot = 0; slot < processBuffer.capacity(); ++slot) {
+            if (processBuffer.states[slot] == ProcessTable::LIVE)
+                watchProcess(watcher, processBuffer.pids[slot]);
+        }
+    }
 
     while (true) {
-        if (gSignalStatus == SIGTERM) { // if sigterm received, save and exit
-            mergeProcesses(processBuffer, uptimeBuffer, CLK_TCK, parallelTracking);
-            saveData(uptimeBuffer);
+        if (watchExits)
+            waitExits(watcher, interval, uptimeBuffer, processBuffer, gSignalStatus, parallelTracking);
+        else
+            waitInterval(interval, gSignalStatus);
+        if (gSignalStatus == SIGTERM) { // if sigterm received, exit, the caller saves
+            closeExitWatcher(watcher);
             return;
         }
 
-        std::vector<int> newPidList = getNewPidList();
-        while (newPidList == pidList) { //check every TT_PRECISION seconds if there was a change in the list of processes
-            sleep(config::precision);
-            newPidList = getNewPidList();
+        // nothing was forked or reaped, /proc is the same
+        bool hasNewCounters = readTaskCounters(newCounters);
+        if (hasNewCounters && hasCounters && newCounters == counters) {
+            lastCheck = bootTicks();
+            interval = adaptInterval(interval, false);
+            continue;
         }
+        counters = newCounters;
+        hasCounters = hasNewCounters;
 
+        // only threads came and went, a reused PID would have another inode
+        listPids(newEntries);
+        if (newEntries == entries) {
+            lastCheck = bootTicks();
+            interval = adaptInterval(interval, false);
+            continue;
+        }
 
-        int offset = 0;
-        for (auto i = 0; i + offset < pidList.size(); i++) {
-            while ((i >= newPidList.size() - 1 || pidList[i + offset] != newPidList[i]) && i + offset < pidList.size()) {
-                if (processBuffer.contains(pidList[i+offset])) {
-                    //the process has ended (i.e. the process is in pidList but not in newPidList)
-                    std::string processName = processBuffer.find(pidList[i + offset])->second.first;
-                    float processStartTime = processBuffer.find(pidList[i + offset])->second.second;
-                    float systemUptime = getSystemUptime();
-
-                    if (!config::track_parallel_processes && parallelTracking.contains(processName)) {
-                        //if i don't want to track parallel running processes, i check if it is one
-                        for (auto s = parallelTracking[processName].begin(); s != parallelTracking[processName].end(); s++) {
-                            if (processStartTime >= s->first && processStartTime <= s->second) {
-                                //if the processes started when another was running, change the time it started
-                                processStartTime = s->second;
-                            } else if (processStartTime < s->first) {
-                                //if the process started before another start (and obviously ended after), remove the included uptime
-                                float includedUptime = s->second - s->first;
-                                uptimeBuffer[processName] -= includedUptime / CLK_TCK;
-                                parallelTracking[processName].erase(s--);
-                            }
-                        }
-                    }
-
-                    //then add the uptime to uptimeBuffer
-                    float processUptime = systemUptime - (processStartTime / CLK_TCK);
-                    processBuffer.erase(processBuffer.find(pidList[i + offset])); // delete the process that just finished
-                    uptimeBuffer[processName] += processUptime; // add its uptime
-                    if (!config::track_parallel_processes)
-                        parallelTracking[processName].push_back(std::make_pair(processStartTime, systemUptime * CLK_TCK)); //we store in clock ticks
-                }
-                offset++;
+        takeSnapshot(newEntries, entries, snapshot, newSnapshot);
+        diffProcesses(snapshot, newSnapshot, started, ended);
 
+        // a reused PID is both in ended and started, the old process has to leave the buffer first
+        // one timestamp for the whole scan, the processes found ended are taken as ended halfway since the last check
+        int64_t now = bootTicks();
+        int64_t endTime = lastCheck + (now - lastCheck) / 2;
+        lastCheck = now;
+        for (auto& process : ended) {
+            endProcess(processBuffer, uptimeBuffer, parallelTracking, process.pid, endTime);
+            unwatchProcess(watcher, process.pid);
+        }
+        if (!config::track_parallel_processes && now - lastCompaction >= COMPACTION_PERIOD * ticksPerSecond()) {
+            compactParallelTracking(processBuffer, parallelTracking, now);
+            lastCompaction = now;
+        }
+        updateProcessBuffer(processBuffer, started);
+        if (watchExits) {
+            for (auto& process : started) {
+                if (processBuffer.contains(process.pid))
+                    watchProcess(watcher, process.pid);
             }
         }
-        updateProcessBuffer(processBuffer, pidList, newPidList, offset);
+        interval = adaptInterval(interval, !started.empty() || !ended.empty());
+        publishSnapshot(processBuffer, uptimeBuffer, parallelTracking);
 
-        pidList = newPidList;
+        // keep both buffers for the next iteration
+        entries.swap(newEntries);
+        snapshot.swap(newSnapshot);
     }
 }
@@ -6,15 +6,28 @@
 #include <string>
 #include <vector>
 
-bool containsNumber(std::string& str);
-std::map <int, std::pair<std::string, int>> initProcessBuffer ();
-void updateProcessBuffer(std::map<int, std::pair<std::string, int>>& processBuffer, std::vector<int>& pidList,
-                         std::vector<int>& newPidList, int& offset);
-std::map<std::string, float> initUptimeBuffer (std::map<int, std::pair<std::string, int>>& processBuffer);
-std::vector <int> getNewPidList ();
-void save(std::map<int, std::pair<std::string, int>> &processBuffer, std::map<std::string, float> &uptimeBuffer,
-          const int &CLK_TCK, volatile sig_atomic_t &gSignalStatus, std::map<std::string, std::vector<std::pair<int, int>>> parallelTracking);
-void timeTracking(std::map<std::string, float> &uptimeBuffer, std::map<int, std::pair<std::string, int>> &processBuffer,
-                  volatile sig_atomic_t& gSignalStatus, std::map<std::string, std::vector<std::pair<int, int>>>& parallelTracking);
+#include "intervalUnion.hpp"
+#include "processTable.hpp"
+
+#include "processDiff.hpp"
+
+/// Time between two compactions of the parallel tracking, in seconds
+const int COMPACTION_PERIOD = 60;
+
+ProcessTable initProcessBuffer ();
+void updateProcessBuffer(ProcessTable& processBuffer, const std::vector<ProcessKey>& started);
+void snapshotProcessBuffer(ProcessTable& processBuffer, std::vector<ProcessKey>& snapshot);
+void resyncProcessBuffer(ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+                         std::vector<IntervalUnion>& parallelTracking, int64_t endTime);
+std::vector<int64_t> initUptimeBuffer (ProcessTable& processBuffer);
+void endProcess(ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+                std::vector<IntervalUnion>& parallelTracking, int pid, int64_t now);
+void mergeProcesses(ProcessTable& processBuffer, std::vector<int64_t>& uptimeBuffer,
+                    std::vector<IntervalUnion>& parallelTracking, int64_t now);
+void compactParallelTracking(ProcessTable& processBuffer, std::vector<IntervalUnion>& parallelTracking, int64_t now);
+void save(ProcessTable &processBuffer, std::vector<int64_t> &uptimeBuffer,
+          const int &CLK_TCK, volatile sig_atomic_t &gSignalStatus, std::vector<IntervalUnion> parallelTracking);
+void timeTracking(std::vector<int64_t> &uptimeBuffer, ProcessTable &processBuffer,
+                  volatile sig_atomic_t& gSignalStatus, std::vector<IntervalUnion>& parallelTracking, int64_t resumedFrom);
 
 #endif //YOTTA_TIMETRACKING_HPP
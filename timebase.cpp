@@ -0,0 +1,85 @@
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+
+#include "timebase.hpp"
+
+/// Nanoseconds in a second
+const int64_t NANOSECONDS = 1000000000;
+
+
+/**
+ * Number of clock ticks in a second
+ *
+ * Start times in /proc/PID/stat are counted in clock ticks, so all the times of yotta are
+ *
+ * @return the number of clock ticks in a second
+ */
+int64_t ticksPerSecond () {
+    static const int64_t ticks = sysconf(_SC_CLK_TCK);
+    return ticks;
+}
+
+/**
+ * Convert a duration to clock ticks, rounded down
+ *
+ * Seconds and the remaining nanoseconds are converted apart so that years of nanoseconds do not overflow
+ *
+ * @param nanoseconds : the duration, in nanoseconds
+ *
+ * @return the duration, in clock ticks
+ */
+int64_t nanosecondsToTicks (int64_t nanoseconds) {
+    return nanoseconds / NANOSECONDS * ticksPerSecond() + nanoseconds % NANOSECONDS * ticksPerSecond() / NANOSECONDS;
+}
+
+/**
+ * Get the time since boot, suspend included
+ *
+ * Same clock as the system uptime in /proc/uptime and the start times of the processes, without opening a file
+ *
+ * @return time since boot, in clock ticks
+ */
+int64_t bootTicks () {
+    struct timespec now{};
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return nanosecondsToTicks(now.tv_sec * NANOSECONDS + now.tv_nsec);
+}
+
+/**
+ * Get the wall clock time of the boot
+ *
+ * Follows the changes of the wall clock, the time since boot does not
+ *
+ * @return time of the boot, in seconds since the epoch
+ */
+double bootEpoch () {
+    struct timespec now{};
+    struct timespec sinceBoot{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    clock_gettime(CLOCK_BOOTTIME, &sinceBoot);
+    return (double) (now.tv_sec - sinceBoot.tv_sec) + (double) (now.tv_nsec - sinceBoot.tv_nsec) / NANOSECONDS;
+}
+
+/**
+ * Convert clock ticks to seconds, to display or send a time
+ *
+ * @param ticks : the duration, in clock ticks
+ *
+ * @return the duration, in seconds
+ */
+double toSeconds (int64_t ticks) {
+    return (double) ticks / ticksPerSecond();
+}
+
+/**
+ * Convert seconds to clock ticks, rounded to the nearest tick
+ *
+ * @param seconds : the duration, in seconds
+ *
+ * @return the duration, in clock ticks
+ */
+int64_t toTicks (double seconds) {
+    return std::llround(seconds * ticksPerSecond());
+}
@@ -0,0 +1,13 @@
+#ifndef YOTTA_TIMEBASE_HPP
+#define YOTTA_TIMEBASE_HPP
+
+#include <cstdint>
+
+int64_t ticksPerSecond ();
+int64_t nanosecondsToTicks (int64_t nanoseconds);
+int64_t bootTicks ();
+double bootEpoch ();
+double toSeconds (int64_t ticks);
+int64_t toTicks (double seconds);
+
+#endif //YOTTA_TIMEBASE_HPP
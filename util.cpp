@@ -1,19 +1,39 @@
+#include <condition_variable>
 #include <csignal>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "config.hpp"
+#include "database.hpp"
+#include "journal.hpp"
+#include "nameTable.hpp"
 #include "log.h"
+#include "timebase.hpp"
 
 const char* logName[] = {"FATAL", "ERROR", "WARN", "INFO", "DEBUG", "TRACE"};
 
 /// Paths to possible config file
 const char* const CONFIG_FILE[4] = {"/etc/yotta", "/etc/yotta.conf", "/etc/yotta/config", "/etc/yotta/yotta.conf"};
 
-/// Dircetory where datas are stored while yotta is not running
-const std::string DATA_DIR = "/var/lib/yotta/";
+/// Fewest items a worker is given, below that the threads cost more than they save
+const size_t MIN_SHARD_SIZE = 2048;
+
+/// Workers runSharded hands its shards to, started as needed and kept for the whole run
+struct WorkerPool {
+    std::mutex mutex;                              ///< protects the queue and the shards left of each caller
+    std::condition_variable wake;                  ///< wakes the workers up when shards are queued
+    std::condition_variable done;                  ///< wakes the callers up when a shard is done
+    std::deque<std::function<void ()>> queue;      ///< shards waiting for a worker
+    size_t workers = 0;                            ///< workers started
+};
 
 
 
@@ -89,19 +109,84 @@ void trim(std::string& s) {
 }
 
 /**
- * Get the time the system was up since last boot
+ * Number of shards a work of a given size should be split into
+ *
+ * At most scan_threads from the config, and each shard gets at least MIN_SHARD_SIZE items
+ *
+ * @param count : number of items to process
+ *
+ * @return the number of shards, at least 1
+ */
+size_t shardCount (size_t count) {
+    size_t shards = count / MIN_SHARD_SIZE;
+    if (shards > (size_t) config::scan_threads)
+        shards = config::scan_threads;
+    return shards < 1 ? 1 : shards;
+}
+
+/**
+ * The worker pool of runSharded
+ *
+ * Never destroyed, its workers may still wait on it while the program exits
+ *
+ * @return the pool
+ */
+WorkerPool& workerPool () {
+    static WorkerPool* pool = new WorkerPool;
+    return *pool;
+}
+
+/**
+ * Main of a worker of the pool
+ *
+ * Run the shards queued one after the other, the state a worker keeps between shards, as its io_uring, lives as long
+ * as the worker
+ */
+void poolWorker () {
+    mask_sig();
+    WorkerPool& pool = workerPool();
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    while (true) {
+        pool.wake.wait(lock, [&] { return !pool.queue.empty(); });
+        std::function<void ()> shard = std::move(pool.queue.front());
+        pool.queue.pop_front();
+        lock.unlock();
+        shard();
+        lock.lock();
+    }
+}
+
+/**
+ * Split a work in contiguous shards and run them in parallel
  *
- * System uptime is the first word stored in '/proc/uptime'
+ * The calling thread takes the first shard, the others are queued for the workers of the pool
+ * The pool gets more workers when there are more shards than workers, it never loses any
+ * Return once all the shards are done
  *
- * @return system uptime in seconds
+ * @param count : number of items to process
+ * @param shards : number of shards, from shardCount
+ * @param work : called with the shard index and the range [begin, end) of items of the shard
  */
-float getSystemUptime () {
-    float systemUptime;
-    std::ifstream uptime("/proc/uptime");
-    if(!uptime.is_open())
-        error("File not found or permission denied : /proc/uptime", FATAL);
-    uptime >> systemUptime;
-    return systemUptime;
+void runSharded (size_t count, size_t shards, const std::function<void (size_t, size_t, size_t)>& work) {
+    WorkerPool& pool = workerPool();
+    size_t left = shards - 1;
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        for (; pool.workers < shards - 1; ++pool.workers)
+            std::thread(poolWorker).detach();
+        for (size_t shard = 1; shard < shards; ++shard) {
+            pool.queue.emplace_back([&, shard] {
+                work(shard, count * shard / shards, count * (shard + 1) / shards);
+                std::lock_guard<std::mutex> shardLock(pool.mutex);
+                --left;
+                pool.done.notify_all();
+            });
+        }
+    }
+    pool.wake.notify_all();
+    work(0, 0, count / shards);
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.done.wait(lock, [&] { return left == 0; });
 }
 
 void loadConfig () {
@@ -125,11 +210,45 @@ void loadConfig () {
         if (optionName == "precision") {
             if (isFloat(value))
                 config::precision = std::stof(value);
+        } else if (optionName == "min_precision") {
+            if (isFloat(value) && std::stof(value) > 0)
+                config::min_precision = std::stof(value);
+        } else if (optionName == "max_precision") {
+            if (isFloat(value) && std::stof(value) > 0)
+                config::max_precision = std::stof(value);
+        } else if (optionName == "pidfd_budget") {
+            if (isFloat(value))
+                config::pidfd_budget = std::stoi(value);
+        } else if (optionName == "listen_backlog") {
+            if (isFloat(value) && std::stoi(value) >= 1)
+                config::listen_backlog = std::stoi(value);
+        } else if (optionName == "client_timeout") {
+            if (isFloat(value) && std::stof(value) > 0)
+                config::client_timeout = std::stof(value);
+        } else if (optionName == "checkpoint_period") {
+            if (isFloat(value) && std::stof(value) >= 0)
+                config::checkpoint_period = std::stof(value);
+        } else if (optionName == "cold_segment_age") {
+            if (isFloat(value) && std::stof(value) >= 0)
+                config::cold_segment_age = std::stof(value);
+        } else if (optionName == "scan_threads") {
+            if (isFloat(value) && std::stoi(value) >= 1)
+                config::scan_threads = std::stoi(value);
         } else if (optionName == "track_parallel_processes") {
             if (value == "true" || value == "True" || value == "t" || value == "T")
                 config::track_parallel_processes = true;
             else if (value == "false" || value == "False" || value == "f" || value == "F")
                 config::track_parallel_processes = false;
+        } else if (optionName == "proc_connector") {
+            if (value == "true" || value == "True" || value == "t" || value == "T")
+                config::proc_connector = true;
+            else if (value == "false" || value == "False" || value == "f" || value == "F")
+                config::proc_connector = false;
+        } else if (optionName == "io_uring") {
+            if (value == "true" || value == "True" || value == "t" || value == "T")
+                config::io_uring = true;
+            else if (value == "false" || value == "False" || value == "f" || value == "F")
+                config::io_uring = false;
         }
     }
     configFile.close();
@@ -138,7 +257,17 @@ void loadConfig () {
 void reloadConfig () {
     //reset to default
     config::precision = 2;
+    config::min_precision = 0.5;
+    config::max_precision = 10;
+    config::scan_threads = 1;
     config::track_parallel_processes = true;
+    config::proc_connector = true;
+    config::io_uring = true;
+    config::pidfd_budget = 4096;
+    config::listen_backlog = 64;
+    config::client_timeout = 5;
+    config::checkpoint_period = 60;
+    config::cold_segment_age = 30;
     //load
     loadConfig();
 }
@@ -147,48 +276,39 @@ void reloadConfig () {
  * Save the buffers in the data file
  *
  * Add uptimes of current boot to those in the database
- * Rewrite the whole database file with the new values
+ * Write the new database next to it and rename it over, then start a new journal
+ * The database stores the sequence number of the journal it folds, a journal or a checkpoint left by a crash in
+ * between is not replayed
+ * If the database can not be read or written, the uptimes stay in the buffer and the journal for the next save
+ * Must not run along with a checkpoint, both rotate the journal
  *
- * @param processBuffer : buffer of still active processes
  * @param uptimeBuffer : buffer of uptimes of already closed program of the actual boot
- * @param CLK_TCK : number of clock ticks in a second
- * @param parallelTracking : buffer of start/end time of each processes
  */
-void saveData(std::map<std::string, float>& uptimeBuffer) {
-    std::string processName;
-    std::string uptimeDataFile = DATA_DIR + "uptime";
-    std::ifstream uptimeDataFileR (uptimeDataFile);
-
-    // Create the file if it was deleted
-    if (!uptimeDataFileR.is_open()) {
-        std::ofstream openingDataFile (uptimeDataFile);
-        openingDataFile.close();
-        uptimeDataFileR.open(uptimeDataFile);
-        if (!uptimeDataFileR.is_open()) {
-            std::string errmsg = "File not found or permission denied : " + uptimeDataFile;
-            error(errmsg.c_str(), FATAL);
-        }
+void saveData(std::vector<int64_t>& uptimeBuffer) {
+    uint64_t sequence = rotateJournal();
+    std::vector<int64_t> totals = uptimeBuffer;
+    Database database;
+    if (database.open(DATABASE_FILE)) {
+        for (size_t entry = 0; entry < database.size(); ++entry)
+            nameEntry(totals, internName(database.name(entry))) += database.total(entry);
+    } else if (std::filesystem::exists(DATABASE_FILE)) {
+        std::string errmsg = "Not a database of this version : " + std::string(DATABASE_FILE);
+        error(errmsg.c_str(), ERROR);
+        cancelRotation();
+        return;
     }
 
-    // Uptimes are stored this way : 'process name: uptime \n process name: uptime ...'
-    float previousUptime;
-    while (uptimeDataFileR >> processName) {
-        std::string buf;
-        uptimeDataFileR >> buf;
-        while (!isFloat(buf)) {
-            processName += " " + buf;
-            uptimeDataFileR >> buf;
-        }
-        previousUptime = std::stof(buf);
-        processName.pop_back(); // removing the colon
-        uptimeBuffer[processName] += previousUptime;
+    std::vector<std::pair<std::string, int64_t>> entries;
+    for (uint32_t id = 0; id < totals.size(); ++id) {
+        if (totals[id] != 0) // names without any uptime are not stored
+            entries.emplace_back(nameOf(id), totals[id]);
     }
-    uptimeDataFileR.close();
-    std::ofstream uptimeDataFileW (uptimeDataFile, std::ios::out | std::ios::trunc);
-
-    for (auto& s : uptimeBuffer) {
-        uptimeDataFileW << s.first << ": " << std::fixed << s.second << std::defaultfloat << "\n";
+    if (!writeDatabase(DATABASE_FILE, std::move(entries), sequence)) {
+        std::string errmsg = "Permission denied : " + std::string(DATABASE_FILE);
+        error(errmsg.c_str(), ERROR);
+        cancelRotation();
+        return;
     }
-    uptimeBuffer.clear();
-    uptimeDataFileW.close();
+    startJournal(0);
+    std::fill(uptimeBuffer.begin(), uptimeBuffer.end(), 0);
 }
\ No newline at end of file
@@ -1,13 +1,19 @@
 #ifndef YOTTA_UTIL_HPP
 #define YOTTA_UTIL_HPP
 
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
 void error (const char * msg, unsigned int level);
 void mask_sig ();
 bool isFloat (std::string& str);
 void trim (std::string& s);
-float getSystemUptime ();
+size_t shardCount (size_t count);
+void runSharded (size_t count, size_t shards, const std::function<void (size_t, size_t, size_t)>& work);
 void loadConfig ();
 void reloadConfig ();
-void saveData (std::map<std::string, float>& uptimeBuffer);
+void saveData (std::vector<int64_t>& uptimeBuffer);
 
 #endif //YOTTA_UTIL_HPP
\ No newline at end of file
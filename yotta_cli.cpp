@@ -1,10 +1,16 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
+#include <ctime>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <vector>
 
+#include <poll.h>
 #include <pwd.h>
 #include <signal.h>
 #include <unistd.h>
@@ -13,11 +19,12 @@
 #include <sys/un.h>
 
 #include "log.h"
+#include "protocol.hpp"
+#include "timebase.hpp"
 #include "util.hpp"
 #include "config.hpp"
-
-/// Dircetory where datas are stored while yotta is not running
-const std::string DATA_DIR = "/var/lib/yotta/";
+#include "database.hpp"
+#include "history.hpp"
 
 /// Path where the socket file is located
 const char* const SOCKET_PATH = "/run/yotta/yotta_socket";
@@ -31,7 +38,11 @@ const std::string HELP_MSG = "Usage: yotta [options] [<process> ...]\n\n"
                              "Options:\n"
                              "  -v, --version\t\t\t\tDisplay the version and exit\n"
                              "  -h, --help\t\t\t\tDipslay this help and exit\n"
-                             "  -b, --boot\t\t\t\tDisplay only the informations since the last boot\n"
+                             "  -b, --boot [<n>]\t\t\tDisplay only the informations since the last boot\n"
+                             "\t\t\t\t\tWith <n>, display those of the <n>th boot before it from the history\n"
+                             "      --since <date>\t\t\tDisplay only the informations since <date> from the history\n"
+                             "      --until <date>\t\t\tDisplay only the informations until <date> from the history\n"
+                             "\t\t\t\t\t<date> is 'YYYY-MM-DD [HH:MM[:SS]]' or a <time> ago, rounded to the hour\n"
                              "  -B, --all-but-boot\t\t\tDisplay all the informations except those of the last boot\n"
                              "  -d, --day\t\t\t\tDisplay the uptime in days\n"
                              "  -H, --hour\t\t\t\tDisplay the uptime in hours\n"
@@ -41,14 +52,19 @@ const std::string HELP_MSG = "Usage: yotta [options] [<process> ...]\n\n"
                              "  -f, --default-time-format\t\tDisplay the uptime in default format\n"
                              "  -g, --greater-uptime-than <time>\tDisplay only the processes with a greater uptime than <time>\n"
                              "  -l, --lower-uptime-than <time>\tDisplay only the processes with a lower uptime than <time>\n"
+                             "  -n, --limit <count>\t\t\tDisplay only the <count> processes with the greatest uptimes\n"
+                             "  -w, --watch\t\t\t\tDisplay the informations since the last boot and refresh them every second\n"
                              "\n"
                              "Root only:\n"
                              "  -r, --reload                        Reload the config file\n"
                              "                                      Changing the config can lead to inaccuracies, use carefully\n"
-                             "      --save                          Save the processes that have already finished\n"
-                             "                                      Yotta will now consider them as part of previous boot\n"
+                             "      --save                          Checkpoint the uptimes of this boot now and wait until it is written\n"
+                             "                                      They are kept even if the daemon is killed, the daemon also does it periodically\n"
+                             "      --checkpoint                    Ask for a checkpoint without waiting for it\n"
+                             "      --stats                         Display the state of the daemon\n"
+                             "      --shutdown                      Stop the daemon, the running processes are counted on by the next one\n"
                              "  -k, --kill                          Force kill the daemon\n"
-                             "                                      This will cause all data of this boot to be lost, try to --save before\n";
+                             "                                      The uptimes since the last checkpoint are lost, try to --save before\n";
 
 
 float isProcessRoot () {
@@ -110,39 +126,108 @@ bool isTime (std::string& str) {
 /**
  * Get the uptimes stored in the data file
  *
- * Read the data file line by line, if the line matches a process the user requested, add the uptime to the buffer
+ * Map the database, look the processes the user requested up in its index, or take all of them if none was requested
  *
  * @param toDisplay : buffer of what will be displayed
  * @param requestedProcesses : processes the user asked for in the command
  */
-void getDataFile (std::map<std::string, std::pair<int, float>>& toDisplay, std::vector<std::string> requestedProcesses) {
-    std::string uptimeDataFile = DATA_DIR + "uptime";
-    std::ifstream uptimeDataFileR (uptimeDataFile);
-    if (uptimeDataFileR) {
-        if (uptimeDataFileR.peek() != std::ifstream::traits_type::eof()) {
-            std::string line;
-            std::string processName;
-            float processUptime;
-
-            while (getline(uptimeDataFileR, line)) {
-                processName = line.substr(0, line.find_last_of(':')); // because string index start at 0, +1-1=0
-                if (requestedProcesses.empty() ||
-                    std::find(requestedProcesses.begin(), requestedProcesses.end(), processName) !=
-                    requestedProcesses.end()) {
-                    processUptime = std::stof(
-                            line.substr(line.find_last_of(' ') + 1)); // because string index start at 0
-                    if (toDisplay.contains(processName))
-                        toDisplay[processName].second += processUptime;
-                    else
-                        toDisplay[processName] = std::make_pair(0, processUptime);
-                }
-            }
-        } else
-            error("No data on a previous boot\n", INFO);
-    } else
+void getDataFile (std::map<std::string, std::pair<int, float>>& toDisplay, const std::vector<std::string>& requestedProcesses) {
+    Database database;
+    if (!database.open(DATABASE_FILE)) {
         error("Data file nonexistant\n", WARN);
+        return;
+    }
+    if (database.size() == 0)
+        error("No data on a previous boot\n", INFO);
+
+    if (requestedProcesses.empty()) {
+        for (size_t entry = 0; entry < database.size(); ++entry)
+            toDisplay[std::string(database.name(entry))].second += toSeconds(database.total(entry));
+    } else {
+        int64_t total;
+        for (auto& processName : requestedProcesses) {
+            if (database.find(processName, total))
+                toDisplay[processName].second += toSeconds(total);
+        }
+    }
+}
+
+/**
+ * Parse a date given to --since or --until
+ *
+ * @param str : 'YYYY-MM-DD', 'YYYY-MM-DD HH:MM', 'YYYY-MM-DD HH:MM:SS' in local time, or a <time> ago
+ * @param date : filled with the date, in seconds since the epoch
+ *
+ * @return true  : if the date is valid
+ *         false : otherwise
+ */
+bool parseDate (std::string str, int64_t& date) {
+    if (!str.empty() && isTime(str)) {
+        date = time(nullptr) - (int64_t) parseTime(str);
+        return true;
+    }
+    std::replace(str.begin(), str.end(), 'T', ' ');
+    for (const char* format : {"%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d"}) {
+        struct tm tm{};
+        const char* end = strptime(str.c_str(), format, &tm);
+        if (end && *end == '\0') {
+            tm.tm_isdst = -1;
+            date = mktime(&tm);
+            return true;
+        }
+    }
+    return false;
 }
 
+/**
+ * Get the uptimes stored in the history
+ *
+ * Only the segments of the boots that overlap the range are mapped, and only the buckets of the range are read
+ *
+ * @param toDisplay : buffer of what will be displayed
+ * @param requestedProcesses : processes the user asked for in the command, all of them if empty
+ * @param since : start of the range, in seconds since the epoch
+ * @param until : end of the range, in seconds since the epoch
+ * @param boot : the boot to take, 0 for the last one, 1 for the one before..., -1 for all of them
+ */
+void getHistory (std::map<std::string, std::pair<int, float>>& toDisplay, const std::vector<std::string>& requestedProcesses,
+                 int64_t since, int64_t until, long boot) {
+    std::vector<HistoryIndexEntry> boots;
+    if (!readHistoryIndex(boots) || boots.empty()) {
+        error("No history\n", WARN);
+        return;
+    }
+    if (boot >= 0) {
+        if ((size_t) boot >= boots.size()) {
+            error("No such boot in the history\n", WARN);
+            return;
+        }
+        boots = {boots[boots.size() - 1 - boot]};
+    }
+
+    for (auto& entry : boots) {
+        if (entry.endTime <= since || entry.bootTime >= until)
+            continue;
+        auto add = [&toDisplay] (std::string_view name, int64_t uptime) {
+            toDisplay[std::string(name)].second += toSeconds(uptime);
+        };
+        // the segments of the old boots are compacted, they are decompressed while they are read
+        Segment segment;
+        ColdSegment coldSegment;
+        if (segment.open(segmentPath(entry.bootId).c_str()))
+            segment.collect(since, until, requestedProcesses, add);
+        else if (coldSegment.open(coldSegmentPath(entry.bootId).c_str()))
+            coldSegment.collect(since, until, requestedProcesses, add);
+    }
+}
+
+/// How the uptimes are displayed, set by the options of the command
+struct DisplayOptions {
+    bool day, hour, minute, second, clockTick, defaultTimeFormat;
+    float greaterUptime, lowerUptime;  ///< in seconds, 0 means no condition
+    unsigned long limit;               ///< 0 means no limit
+};
+
 /**
  * Check if the argument is of the short form
  *
@@ -161,53 +246,322 @@ bool isShortArg (char*& arg) {
 }
 
 /**
- * Get the buffer of processes that have already finished or are still running (their name and uptime) and add it to the buffer to display
+ * Read exactly a given number of bytes from a socket
  *
- * Connect to the socket, receive one line for each process, parse the line and add the datas to the buffer to display
+ * @param sockfd : the socket
+ * @param buf : where the bytes are written
+ * @param size : number of bytes to read
  *
- * @param toDisplay : buffer of what will be displayed
- * @param requestedProcesses : processes the user asked for in the command
+ * @return true  : if all the bytes were read
+ *         false : if the daemon closed the connection before
  */
-void getUptimeBuffer (std::map<std::string, std::pair<int, float>>& toDisplay, std::vector<std::string> requestedProcesses) {
-    int sockfd, servlen, n;
+bool readAll (int sockfd, char* buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = read(sockfd, buf, size);
+        if (n <= 0)
+            return false;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * Connect to the socket of the daemon
+ *
+ * Nobody listening on the socket is how a daemon that is not running is told apart
+ *
+ * @return the socket, -1 if the daemon is not running
+ */
+int connectDaemon () {
+    int sockfd, servlen;
     struct sockaddr_un serv_addr{};
-    char buffer[82];
 
     bzero((char *) &serv_addr, sizeof(serv_addr));
     serv_addr.sun_family = AF_UNIX;
     strcpy(serv_addr.sun_path, SOCKET_PATH);
     servlen = strlen(serv_addr.sun_path) + sizeof(serv_addr.sun_family);
-    if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    if ((sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
         error("Creating the socket\n", FATAL);
 
-    if (connect(sockfd, (struct sockaddr *) &serv_addr, servlen) < 0)
-        error("Connecting to the socket\n", FATAL);
-    bzero(buffer, 82);
-
-
-    write(sockfd, "uptimeBuffer", 13);
-
-    read(sockfd, buffer, 80);
-    write(sockfd, "1", 1); // send "ok, received"
-    n = std::stoi(buffer);
-    for (int i = 0; i < n; ++i) {
-        // each process is sent through the socket in the form of "name\1uptime\n"
-        bzero(buffer, 82);
-        read(sockfd, buffer, 80);
-        std::string buf;
-        buf += buffer;
-        size_t pos1 = buf.find('\1');
-        std::string processName = buf.substr(0, pos1);
-        if (requestedProcesses.empty() || std::find(requestedProcesses.begin(), requestedProcesses.end(), processName) != requestedProcesses.end()) {
-            size_t end = buf.find('\n');
-            size_t length = end - pos1;
-            std::string uptime = buf.substr(pos1 + 1, length);
-            float processUptime = std::stof(uptime);
-            toDisplay[processName].second = processUptime;
+    if (connect(sockfd, (struct sockaddr *) &serv_addr, servlen) < 0) {
+        if (errno != ENOENT && errno != ECONNREFUSED)
+            error("Connecting to the socket\n", FATAL);
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/**
+ * Connect to the socket and send a request of the binary protocol
+ *
+ * @param type : type of the request
+ * @param requestedProcesses : processes the user asked for in the command, all of them if empty
+ * @param query : conditions on the uptimes, evaluated by the daemon
+ *
+ * @return the socket, to read the answer from, -1 if the daemon is not running
+ */
+int sendRequest (FrameType type, const std::vector<std::string>& requestedProcesses, const UptimeQuery& query) {
+    int sockfd = connectDaemon();
+    if (sockfd < 0)
+        return -1;
+
+    std::string request((const char*) &query, sizeof(query));
+    for (auto& processName : requestedProcesses)
+        appendName(request, processName);
+    FrameHeader header = makeFrameHeader(type, requestedProcesses.size(), request.size());
+    request.insert(0, (const char*) &header, sizeof(header));
+    write(sockfd, request.data(), request.size());
+    return sockfd;
+}
+
+/**
+ * Read a whole frame sent by the daemon
+ *
+ * @param sockfd : the socket
+ * @param header : filled with the header of the frame
+ * @param payload : filled with the payload of the frame
+ * @param type : type of frame expected
+ *
+ * @return true  : if the frame was read
+ *         false : if the daemon closed the connection before
+ */
+bool readFrame (int sockfd, FrameHeader& header, std::string& payload, FrameType type) {
+    if (!readAll(sockfd, (char*) &header, sizeof(header)) || !isFrameHeader(header))
+        return false;
+    if (header.version != PROTOCOL_VERSION || header.type != type) {
+        std::string errmsg = "The daemon speaks version " + std::to_string(header.version) + " of the protocol, restart it\n";
+        error(errmsg.c_str(), FATAL);
+    }
+    payload.assign(header.length, '\0');
+    return readAll(sockfd, payload.data(), payload.size());
+}
+
+/**
+ * Get the buffer of processes that have already finished or are still running (their name and uptime) and add it to the buffer to display
+ *
+ * Connect to the socket, send an UPTIMES_REQUEST and receive the whole answer at once
+ * The daemon only sends the requested processes that answer the query
+ * Nothing is added if the daemon is not running
+ *
+ * @param toDisplay : buffer of what will be displayed
+ * @param requestedProcesses : processes the user asked for in the command, all of them if empty
+ * @param query : conditions on the uptimes, evaluated by the daemon
+ */
+void getUptimeBuffer (std::map<std::string, std::pair<int, float>>& toDisplay, const std::vector<std::string>& requestedProcesses,
+                      const UptimeQuery& query) {
+    int sockfd = sendRequest(UPTIMES_REQUEST, requestedProcesses, query);
+    if (sockfd < 0) {
+        error("The daemon is not running\n", WARN);
+        return;
+    }
+    FrameHeader header;
+    std::string payload;
+    if (!readFrame(sockfd, header, payload, UPTIMES_RESPONSE))
+        error("Receiving the uptimes from the daemon\n", FATAL);
+    close(sockfd);
+
+    const char* cursor = payload.data();
+    std::string_view processName;
+    int64_t uptime;
+    for (uint32_t i = 0; i < header.count && readUptimeRecord(cursor, payload.data() + payload.size(), processName, uptime); ++i)
+        toDisplay[std::string(processName)].second = (float) uptime / sysconf(_SC_CLK_TCK);
+}
+
+/**
+ * Display the uptimes
+ *
+ * Only those that meet the uptime conditions, and among them the greatest ones if there is a limit
+ *
+ * @param toDisplay : what will be displayed, names with their PID and uptime in seconds
+ * @param options : how to display them
+ */
+void displayUptimes (std::map<std::string, std::pair<int, float>> toDisplay, const DisplayOptions& options) {
+    if (options.limit && toDisplay.size() > options.limit) {
+        // keep the greatest uptimes among those that meet the uptime conditions
+        std::vector<std::pair<float, std::string>> shown;
+        for (auto& s : toDisplay) {
+            if (!((options.greaterUptime && s.second.second <= options.greaterUptime) || (options.lowerUptime && s.second.second >= options.lowerUptime)))
+                shown.emplace_back(s.second.second, s.first);
+        }
+        if (shown.size() > options.limit) {
+            std::partial_sort(shown.begin(), shown.begin() + options.limit, shown.end(), std::greater<>());
+            for (auto s = shown.begin() + options.limit; s != shown.end(); ++s)
+                toDisplay.erase(s->second);
+        }
+    }
+
+    std::cout << std::setw(40) << "Name" << std::setw(6) << "PID";
+    if (options.defaultTimeFormat || (!options.day && !options.hour && !options.minute && !options.second && !options.clockTick))
+        std::cout << std::setw(19) << "Uptime";
+    if (options.day)
+        std::cout << std::setw(9) << "Days";
+    if (options.hour)
+        std::cout << std::setw(12) << "Hours";
+    if (options.minute)
+        std::cout << std::setw(16) << "Minutes";
+    if (options.second)
+        std::cout << std::setw(20) << "Seconds";
+    if (options.clockTick)
+        std::cout << std::setw(20) << "Jiffies";
+    for (auto& s : toDisplay) {
+        if (!((options.greaterUptime && s.second.second <= options.greaterUptime) || (options.lowerUptime && s.second.second >= options.lowerUptime))) { // check uptime conditions
+            std::cout << "\n" << std::setw(40) << s.first;
+            if (s.second.first != 0)
+                std::cout << std::setw(6) << s.second.first;
+            else
+                std::cout << std::setw(6) << "    ";
+
+            if (options.defaultTimeFormat || (!options.day && !options.hour && !options.minute && !options.second && !options.clockTick)) {
+                std::string uptime;
+
+                /// calculate time
+                int total = s.second.second; //in seconds
+                int seconds = total % 60;
+                int minutes = ((total - seconds) / 60) % 60;
+                int hours = ((total - 60*minutes - seconds) / (60*60)) % 24;
+                int days = (total - 24*60*hours - 60*minutes - seconds) / (24*60*60);
+
+                /// display only what is needed
+                if (days >= 1)
+                    uptime = std::to_string(days) + "d " + std::to_string(hours) + 'h' + std::to_string(minutes)
+                                     + 'm' + std::to_string(seconds) + 's';
+                else if (hours >= 1)
+                    uptime = std::to_string(hours) + 'h' + std::to_string(minutes) + 'm' + std::to_string(seconds) + 's';
+                else if (minutes >= 1)
+                    uptime = std::to_string(minutes) + 'm' + std::to_string(seconds) + 's';
+                else
+                    uptime = std::to_string(seconds) + 's';
+                std::cout << std::setw(19) << uptime;
+            }
+            if (options.day) {
+                float days = s.second.second / (60*60*24);
+                std::cout << std::setw(9) << std::fixed << std::setprecision(2) << days;
+            }
+            if (options.hour) {
+                float hours = s.second.second / (60*60);
+                std::cout << std::setw(12) << std::fixed << std::setprecision(2) << hours;
+            }
+            if (options.minute) {
+                float minutes = s.second.second / 60;
+                std::cout << std::setw(16) << std::fixed << std::setprecision(2) << minutes;
+            }
+            if (options.second) {
+                float seconds = s.second.second;
+                std::cout << std::setw(20) << std::fixed << std::setprecision(2) << seconds;
+            }
+            if (options.clockTick) {
+                int jiffies = s.second.second * sysconf(_SC_CLK_TCK);
+                std::cout << std::setw(20) << jiffies;
+            }
+        }
+    }
+    std::cout << '\n';
+    if (options.clockTick) {
+        int jps = sysconf(_SC_CLK_TCK);
+        std::cout << "1 clock tick = " << (float)1/jps << " second   |   " << "1 second = " << jps << " clock ticks\n";
+    }
+}
+
+/**
+ * Display the uptimes since the last boot and refresh them every second until the daemon stops
+ *
+ * Subscribe to the daemon, which first sends all the uptimes, then only those that changed after each scan
+ * Between two changes an uptime grows at the rate the daemon sent with it
+ *
+ * @param requestedProcesses : processes the user asked for in the command, all of them if empty
+ * @param options : how to display them
+ */
+void watchUptimes (const std::vector<std::string>& requestedProcesses, const DisplayOptions& options) {
+    struct Uptime {
+        int64_t time;    ///< when the daemon sent it, in clock ticks since boot
+        int64_t uptime;  ///< in clock ticks
+        uint32_t rate;   ///< clock ticks gained per clock tick since then
+    };
+    std::map<std::string, Uptime> uptimes;
+
+    int sockfd = sendRequest(SUBSCRIBE_REQUEST, requestedProcesses, UptimeQuery{});
+    if (sockfd < 0)
+        error("The daemon is not running\n", FATAL);
+    struct pollfd pfd{sockfd, POLLIN, 0};
+    int64_t nextDisplay = 0;
+    while (true) {
+        int64_t now = bootTicks();
+        if (now >= nextDisplay) {
+            std::map<std::string, std::pair<int, float>> toDisplay;
+            for (auto& [processName, uptime] : uptimes) {
+                int64_t total = uptime.uptime + uptime.rate * (now - uptime.time);
+                if (total != 0)
+                    toDisplay[processName].second = toSeconds(total);
+            }
+            std::cout << "\033[H\033[2J"; // clear the terminal
+            displayUptimes(toDisplay, options);
+            std::cout.flush();
+            nextDisplay = now + ticksPerSecond();
         }
-        write(sockfd, "1", 1); // to say "ok, received"
+
+        int timeout = (int) ((nextDisplay - now) * 1000 / ticksPerSecond()) + 1;
+        if (poll(&pfd, 1, timeout) <= 0)
+            continue;
+
+        FrameHeader header;
+        std::string payload;
+        int64_t time;
+        if (!readFrame(sockfd, header, payload, UPTIMES_DELTA) || payload.size() < sizeof(time))
+            error("The daemon stopped\n", FATAL);
+        memcpy(&time, payload.data(), sizeof(time));
+        const char* cursor = payload.data() + sizeof(time);
+        std::string_view processName;
+        Uptime uptime{time, 0, 0};
+        for (uint32_t i = 0; i < header.count &&
+                readDeltaRecord(cursor, payload.data() + payload.size(), processName, uptime.uptime, uptime.rate); ++i)
+            uptimes[std::string(processName)] = uptime;
     }
+}
+
+/**
+ * Send an admin command to the daemon and display its answer
+ *
+ * The daemon checks that the command comes from root
+ *
+ * @param command : the command
+ */
+void sendAdminCommand (AdminCommand command) {
+    int sockfd = connectDaemon();
+    if (sockfd < 0)
+        error("The daemon is not running\n", FATAL);
+    FrameHeader header = makeFrameHeader(ADMIN_REQUEST, command, 0);
+    write(sockfd, &header, sizeof(header));
+
+    std::string payload;
+    if (!readFrame(sockfd, header, payload, ADMIN_RESPONSE))
+        error("Receiving the answer of the daemon\n", FATAL);
+    close(sockfd);
+    std::cout << payload;
+    if (header.count == ADMIN_DENIED)
+        error("The daemon only takes this command from root\n", FATAL);
+    else if (header.count == ADMIN_FAILED)
+        error("The daemon could not run the command\n", FATAL);
+    else if (header.count != ADMIN_DONE)
+        error("The daemon does not know the command, restart it\n", FATAL);
+}
+
+/**
+ * Force kill the daemon
+ *
+ * Its PID is given by the credentials of the socket, so no other process is looked for
+ */
+void killDaemon () {
+    int sockfd = connectDaemon();
+    if (sockfd < 0)
+        error("The daemon is not running\n", FATAL);
+    struct ucred credentials{};
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0 || credentials.pid < 1)
+        error("Getting the PID of the daemon\n", FATAL);
     close(sockfd);
+    kill(credentials.pid, SIGKILL);
 }
 
 /**
@@ -226,13 +580,18 @@ void getUptimeBuffer (std::map<std::string, std::pair<int, float>>& toDisplay, s
 int main (int argc, char* argv[]) {
     // Display options
     bool boot_opt(false), allButBoot_opt(false), day_opt(false), hour_opt(false), minute_opt(false), second_opt(false), 
-         clockTick_opt(false), defaultTimeFormat_opt(false);
+         clockTick_opt(false), defaultTimeFormat_opt(false), watch_opt(false);
     float greaterUptime_opt(0), lowerUptime_opt(0);
+    long bootNumber_opt(-1); // -1 means no boot of the history was asked for
+    int64_t since_opt(0), until_opt(LLONG_MAX);
+    bool history_opt(false);
+    unsigned long limit_opt(0);
     std::string greaterUptimeBuf, lowerUptimeBuf;
     std::vector<std::string> requestedProcesses(0); //processes the user mentioned in the command
 
     // Admin options
-    bool kill_opt(false), save_opt(false), reload_opt(false);
+    bool kill_opt(false);
+    std::vector<AdminCommand> adminCommands;
 
     std::vector<std::string> argsBuffer;
 
@@ -256,8 +615,28 @@ int main (int argc, char* argv[]) {
         } else if (arg == "-h" || arg == "--help") {
             std::cout << HELP_MSG;
             exit(0);
-        } else if (arg == "-b" || arg == "--boot")
-            boot_opt = true;
+        } else if (arg == "-b" || arg == "--boot") {
+            if (argsBuffer.size() > 1 && !argsBuffer[1].empty() && std::all_of(argsBuffer[1].begin(), argsBuffer[1].end(), ::isdigit)) {
+                bootNumber_opt = std::stol(argsBuffer[1]);
+                history_opt = true;
+                argsBuffer.erase(argsBuffer.begin()+1);
+            } else
+                boot_opt = true;
+        } else if (arg == "--since" || arg == "--until") {
+            int64_t date;
+            if (argsBuffer.size() > 1 && parseDate(argsBuffer[1], date)) {
+                (arg == "--since" ? since_opt : until_opt) = date;
+                history_opt = true;
+            } else {
+                std::cout << "Provided value to argument '" + arg + "' is not a date\n\n"
+                             "Usage: 'yotta " + arg + " <date>' where <date> is 'YYYY-MM-DD [HH:MM[:SS]]' in local time\n"
+                             "       or a <time> ago, of the form <<number>[d | h | m | s | j] ...>\n";
+                exit(1);
+            }
+            argsBuffer.erase(argsBuffer.begin()+1);
+        }
+        else if (arg == "-w" || arg == "--watch")
+            watch_opt = true;
         else if (arg == "-B" || arg == "--all-but-boot")
             allButBoot_opt = true;
         else if (arg == "-d" || arg == "--day")
@@ -294,16 +673,32 @@ int main (int argc, char* argv[]) {
                 exit(1);
             }
             argsBuffer.erase(argsBuffer.begin()+1);
+        } else if (arg == "-n" || arg == "--limit") {
+            if (argsBuffer.size() > 1 && !argsBuffer[1].empty() && std::all_of(argsBuffer[1].begin(), argsBuffer[1].end(), ::isdigit))
+                limit_opt = std::stoul(argsBuffer[1]);
+            else {
+                std::cout << "Provided value to argument '-n | --limit' is not a positive integer\n\n"
+                             "Usage: 'yotta -n <count>' to show only the <count> processes with the greatest uptimes\n";
+                exit(1);
+            }
+            argsBuffer.erase(argsBuffer.begin()+1);
         } else if (arg[0] != '-') {
             requestedProcesses.push_back(arg);
-        } else if (arg == "-k" || arg == "--kill" || arg == "--save" || arg == "-r" || arg == "--reload"){ //root only options
+        } else if (arg == "-k" || arg == "--kill" || arg == "--save" || arg == "-r" || arg == "--reload" ||
+                   arg == "--checkpoint" || arg == "--shutdown" || arg == "--stats"){ //root only options
             if (isProcessRoot()) {
                 if (arg == "-k" || arg == "--kill") {
                     kill_opt = true;
                 } else if (arg == "--save") {
-                    save_opt = true;
+                    adminCommands.push_back(SAVE_COMMAND);
                 } else if (arg == "-r" || arg == "--reload") {
-                    reload_opt = true;
+                    adminCommands.push_back(RELOAD_COMMAND);
+                } else if (arg == "--checkpoint") {
+                    adminCommands.push_back(CHECKPOINT_COMMAND);
+                } else if (arg == "--shutdown") {
+                    adminCommands.push_back(SHUTDOWN_COMMAND);
+                } else if (arg == "--stats") {
+                    adminCommands.push_back(STATS_COMMAND);
                 }
             } else {
                 std::cout << "You must be root to execute '" + arg + "' argument";
@@ -323,6 +718,19 @@ int main (int argc, char* argv[]) {
         exit(1);
     }
 
+    if (history_opt && (boot_opt || allButBoot_opt || watch_opt)) {
+        std::cout << "Using '--since', '--until' or '-b | --boot <n>' with '-b | --boot', '-B | --all-but-boot' or "
+                     "'-w | --watch' in the same command result is impossible\n"
+                     "Use 'yotta -h' for help\n";
+        exit(1);
+    }
+
+    if (watch_opt && allButBoot_opt) {
+        std::cout << "Using '-w | --watch' and '-B | --all-but-boot' in the same command result is impossible\n"
+                     "Use 'yotta -h' for help\n";
+        exit(1);
+    }
+
     if (!greaterUptimeBuf.empty())
         greaterUptime_opt = parseTime(greaterUptimeBuf);
     if (!lowerUptimeBuf.empty())
@@ -334,121 +742,44 @@ int main (int argc, char* argv[]) {
                      "The parameter of '-l | --lower-uptime-than' has to be greater than the parameter of '-g | --greater-uptime-than'\n";
         exit(1);
     }
-    if (kill_opt || save_opt || reload_opt) {
-        //get pid of daemon
-        char line[10]; //up to large enough pid imo
-        FILE *cmd = popen("pidof -s yotta_daemon", "r");
-        unsigned long int pid = 0;
-        fgets(line, 10, cmd);
-        pid = strtoul(line, NULL, 10);
-        pclose(cmd);
-
-        if (save_opt) {
-            if (pid < 1) {
-                error("The damon is not running\n", FATAL);
-            }
-            kill(pid, SIGUSR1);
-            exit(0);
-        }
-        if (kill_opt) {
-            if (pid < 1) {
-                error("The damon is not running\n", FATAL);
-            }
-            kill(pid, SIGKILL);
-            exit(0);
-        }
-        if (reload_opt) {
-            if (pid < 1) {
-                error("The damon is not running\n", FATAL);
-            }
-            kill(pid, SIGUSR2);
-            exit(0);
-        }
+    if (kill_opt || !adminCommands.empty()) {
+        // in the order they were given, a kill last as nothing answers after it
+        for (AdminCommand command : adminCommands)
+            sendAdminCommand(command);
+        if (kill_opt)
+            killDaemon();
+        exit(0);
+    }
+
+    DisplayOptions options{day_opt, hour_opt, minute_opt, second_opt, clockTick_opt, defaultTimeFormat_opt,
+                           greaterUptime_opt, lowerUptime_opt, limit_opt};
+    if (watch_opt) {
+        watchUptimes(requestedProcesses, options);
     }
 
     std::map<std::string, std::pair<int, float>> toDisplay; //everything in the map will be displayed
 
+    if (history_opt) {
+        getHistory(toDisplay, requestedProcesses, since_opt, until_opt, bootNumber_opt);
+        displayUptimes(toDisplay, options);
+        exit(0);
+    }
+
     if (!allButBoot_opt) {
-        if (system("pidof yotta_daemon > /dev/null") == 0) {
-            getUptimeBuffer(toDisplay, requestedProcesses);
-        } else {
-            error("The daemon is not running\n", WARN);
+        // the uptime conditions apply to the sum with the data file, the daemon can only evaluate them alone
+        UptimeQuery query{};
+        if (boot_opt) {
+            query.minUptime = toTicks(greaterUptime_opt);
+            query.maxUptime = toTicks(lowerUptime_opt);
+            query.limit = limit_opt;
         }
+        getUptimeBuffer(toDisplay, requestedProcesses, query);
     }
     if (!boot_opt) {
         getDataFile(toDisplay, requestedProcesses);
     }
 
-    std::cout << std::setw(40) << "Name" << std::setw(6) << "PID";
-    if (defaultTimeFormat_opt || (!day_opt && !hour_opt && !minute_opt && !second_opt && !clockTick_opt))
-        std::cout << std::setw(19) << "Uptime";
-    if (day_opt)
-        std::cout << std::setw(9) << "Days";
-    if (hour_opt)
-        std::cout << std::setw(12) << "Hours";
-    if (minute_opt)
-        std::cout << std::setw(16) << "Minutes";
-    if (second_opt)
-        std::cout << std::setw(20) << "Seconds";
-    if (clockTick_opt)
-        std::cout << std::setw(20) << "Jiffies";
-    for (auto& s : toDisplay) {
-        if (!((greaterUptime_opt && s.second.second <= greaterUptime_opt) || (lowerUptime_opt && s.second.second >= lowerUptime_opt))) { // check uptime conditions
-            std::cout << "\n" << std::setw(40) << s.first;
-            if (s.second.first != 0)
-                std::cout << std::setw(6) << s.second.first;
-            else
-                std::cout << std::setw(6) << "    ";
-
-            if (defaultTimeFormat_opt || (!day_opt && !hour_opt && !minute_opt && !second_opt && !clockTick_opt)) {
-                std::string uptime;
-
-                /// calculate time
-                int total = s.second.second; //in seconds
-                int seconds = total % 60;
-                int minutes = ((total - seconds) / 60) % 60;
-                int hours = ((total - 60*minutes - seconds) / (60*60)) % 24;
-                int days = (total - 24*60*hours - 60*minutes - seconds) / (24*60*60);
-
-                /// display only what is needed
-                if (days >= 1)
-                    uptime = std::to_string(days) + "d " + std::to_string(hours) + 'h' + std::to_string(minutes)
-                                     + 'm' + std::to_string(seconds) + 's';
-                else if (hours >= 1)
-                    uptime = std::to_string(hours) + 'h' + std::to_string(minutes) + 'm' + std::to_string(seconds) + 's';
-                else if (minutes >= 1)
-                    uptime = std::to_string(minutes) + 'm' + std::to_string(seconds) + 's';
-                else
-                    uptime = std::to_string(seconds) + 's';
-                std::cout << std::setw(19) << uptime;
-            }
-            if (day_opt) {
-                float days = s.second.second / (60*60*24);
-                std::cout << std::setw(9) << std::fixed << std::setprecision(2) << days;
-            }
-            if (hour_opt) {
-                float hours = s.second.second / (60*60);
-                std::cout << std::setw(12) << std::fixed << std::setprecision(2) << hours;
-            }
-            if (minute_opt) {
-                float minutes = s.second.second / 60;
-                std::cout << std::setw(16) << std::fixed << std::setprecision(2) << minutes;
-            }
-            if (second_opt) {
-                float seconds = s.second.second;
-                std::cout << std::setw(20) << std::fixed << std::setprecision(2) << seconds;
-            }
-            if (clockTick_opt) {
-                int jiffies = s.second.second * sysconf(_SC_CLK_TCK);
-                std::cout << std::setw(20) << jiffies;
-            }
-        }
-    }
-    std::cout << '\n';
-    if (clockTick_opt) {
-        int jps = sysconf(_SC_CLK_TCK);
-        std::cout << "1 clock tick = " << (float)1/jps << " second   |   " << "1 second = " << jps << " clock ticks\n";
-    }
+    displayUptimes(toDisplay, options);
     exit(0);
 }
 
@@ -6,9 +6,17 @@
 #include <thread>
 #include <unistd.h>
 
+#include "checkpoint.hpp"
 #include "config.hpp"
+#include "database.hpp"
+#include "intervalUnion.hpp"
+#include "journal.hpp"
+#include "processTable.hpp"
+#include "snapshot.hpp"
 #include "socket.hpp"
+#include "state.hpp"
 #include "timeTracking.hpp"
+#include "timebase.hpp"
 #include "util.hpp"
 
 
@@ -36,6 +44,7 @@ volatile std::sig_atomic_t gSignalStatus = 0;
  */
 void signalHandler (int signum) {
     gSignalStatus = signum;
+    wakeSocket();
 }
 
 /**
@@ -55,13 +64,6 @@ void createNecessaryFiles () {
     }
 }
 
-void testt () {
-    while (true) {
-        std::cout << config::track_parallel_processes << " " << config::precision << std::endl;
-        sleep(1);
-    }
-}
-
 /**
  * Main
  *
@@ -75,20 +77,58 @@ int main () {
     std::signal(SIGUSR2, signalHandler); // reload request by the root user
 
     createNecessaryFiles();
+    convertTextDatabase();
+
+    std::vector<int64_t> uptimeBuffer;
+    ProcessTable processBuffer;
+    std::vector<IntervalUnion> parallelTracking;
+
+    // the buffers of the previous daemon go on being counted, unless the system rebooted since
+    // after a crash, the processes running at its last checkpoint
+    int64_t stoppedAt = 0;
+    bool sameBoot = false;
+    uint64_t stateSequence = 0;
+    bool restored = loadState(STATE_FILE, processBuffer, uptimeBuffer, parallelTracking, stoppedAt, sameBoot,
+                              stateSequence);
+    std::vector<EarlierRecord> ended;
+    uint64_t checkpointSequence = replayJournal(ended, restored ? stateSequence : 0);
 
     loadConfig();
 
-    std::map<std::string, float> uptimeBuffer;
-    std::map<int, std::pair<std::string, int>> processBuffer;
-    std::map<std::string, std::vector<std::pair<int, int>>> parallelTracking;
-
-    std::thread test (testt);
-
-    std::thread thSocket(ySocket, std::ref(uptimeBuffer), std::ref(processBuffer), std::ref(gSignalStatus), std::ref(parallelTracking));
+    if (!restored && checkpointSequence != 0)
+        restored = recoverCheckpoint(checkpointSequence, ended, processBuffer, parallelTracking, stoppedAt, sameBoot);
+    if (restored) {
+        if (sameBoot) {
+            resumeHistory(projectUptimes(TrackingSnapshot{0, stoppedAt, processBuffer, uptimeBuffer, parallelTracking},
+                                         stoppedAt));
+        } else {
+            mergeProcesses(processBuffer, uptimeBuffer, parallelTracking, stoppedAt);
+            saveData(uptimeBuffer);
+            processBuffer.clear();
+            parallelTracking.clear();
+            stoppedAt = 0;
+        }
+    }
 
-    test.join();
-    timeTracking(uptimeBuffer, processBuffer, gSignalStatus, parallelTracking);
+    std::thread thSocket(ySocket, std::ref(gSignalStatus));
+    std::thread thJournal(journalThread);
+    std::thread thCheckpoint(checkpointThread);
+
+    timeTracking(uptimeBuffer, processBuffer, gSignalStatus, parallelTracking, stoppedAt);
+
+    // the state of the stop holds the journal as it ends, no checkpoint may rotate it along
+    stopCheckpoints();
+    thCheckpoint.join();
+    // the buffers are left to the next daemon, they are only saved, the running processes as ended, if the state
+    // can't be written
+    stoppedAt = bootTicks();
+    if (!writeState(STATE_FILE, processBuffer, uptimeBuffer, parallelTracking, stoppedAt, syncJournal())) {
+        mergeProcesses(processBuffer, uptimeBuffer, parallelTracking, stoppedAt);
+        saveData(uptimeBuffer);
+    }
 
+    stopJournal();
+    thJournal.join();
     thSocket.join();
 
     std::fclose(stderr); // end the redirection of stderr